@@ -0,0 +1,177 @@
+// Compares the unrolled BasicMat kernels with the generic loops they
+// replaced (NaiveMat) at arm sizes from 3 to 12 joints.
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include "BasicMat.h"
+#include "NaiveMat.h"
+
+using arm_slam::BasicMat;
+using arm_slam::NaiveMat;
+
+template <typename Mat> static void Fill(Mat& mat, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        mat[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+// A well conditioned symmetric positive definite matrix, J^T J + I.
+template <size_t N> static BasicMat<N, N> MakeSPD()
+{
+    BasicMat<2 * N, N> J;
+    Fill(J, 2 * N * N);
+    BasicMat<N, N> H = J.TransposeMult(J);
+    for (size_t i = 0; i < N; i++)
+    {
+        H(i, i) += 1.0f;
+    }
+    return H;
+}
+
+template <size_t N> static void BM_NaiveMultiply(benchmark::State& state)
+{
+    NaiveMat<N, N> a;
+    NaiveMat<N, N> b;
+    Fill(a, N * N);
+    Fill(b, N * N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(a);
+        NaiveMat<N, N> c = a * b;
+        benchmark::DoNotOptimize(c);
+    }
+}
+
+template <size_t N> static void BM_UnrolledMultiply(benchmark::State& state)
+{
+    BasicMat<N, N> a;
+    BasicMat<N, N> b;
+    Fill(a, N * N);
+    Fill(b, N * N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(a);
+        BasicMat<N, N> c = a * b;
+        benchmark::DoNotOptimize(c);
+    }
+}
+
+// J^T g for a 2 x N linear Jacobian, the per point tracking product.
+template <size_t N> static void BM_NaiveJacobianTranspose(benchmark::State& state)
+{
+    NaiveMat<2, N> J;
+    NaiveMat<2, 1> g;
+    Fill(J, 2 * N);
+    Fill(g, 2);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(J);
+        NaiveMat<N, 1> c = J.Transpose() * g;
+        benchmark::DoNotOptimize(c);
+    }
+}
+
+template <size_t N> static void BM_UnrolledJacobianTranspose(benchmark::State& state)
+{
+    BasicMat<2, N> J;
+    BasicMat<2, 1> g;
+    Fill(J, 2 * N);
+    Fill(g, 2);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(J);
+        BasicMat<N, 1> c = J.TransposeMult(g);
+        benchmark::DoNotOptimize(c);
+    }
+}
+
+// J^T J for a 2 x N linear Jacobian, the Gauss-Newton normal equations.
+template <size_t N> static void BM_NaiveNormalEquations(benchmark::State& state)
+{
+    NaiveMat<2, N> J;
+    Fill(J, 2 * N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(J);
+        NaiveMat<N, N> H = J.Transpose() * J;
+        benchmark::DoNotOptimize(H);
+    }
+}
+
+template <size_t N> static void BM_UnrolledNormalEquations(benchmark::State& state)
+{
+    BasicMat<2, N> J;
+    Fill(J, 2 * N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(J);
+        BasicMat<N, N> H = J.TransposeMult(J);
+        benchmark::DoNotOptimize(H);
+    }
+}
+
+template <size_t N> static void BM_NaiveCholeskySolve(benchmark::State& state)
+{
+    BasicMat<N, N> spd = MakeSPD<N>();
+    NaiveMat<N, N> H;
+    NaiveMat<N, 1> b;
+    for (size_t i = 0; i < N * N; i++)
+    {
+        H[i] = spd[i];
+    }
+    Fill(b, N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(H);
+        NaiveMat<N, 1> x;
+        H.CholeskySolve(b, x);
+        benchmark::DoNotOptimize(x);
+    }
+}
+
+template <size_t N> static void BM_CholeskySolve(benchmark::State& state)
+{
+    BasicMat<N, N> H = MakeSPD<N>();
+    BasicMat<N, 1> b;
+    Fill(b, N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(H);
+        BasicMat<N, 1> x;
+        H.CholeskySolve(b, x);
+        benchmark::DoNotOptimize(x);
+    }
+}
+
+template <size_t N> static void BM_LDLTSolve(benchmark::State& state)
+{
+    BasicMat<N, N> H = MakeSPD<N>();
+    BasicMat<N, 1> b;
+    Fill(b, N);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(H);
+        BasicMat<N, 1> x;
+        H.LDLTSolve(b, x);
+        benchmark::DoNotOptimize(x);
+    }
+}
+
+#define BENCHMARK_SIZES(name) \
+    BENCHMARK_TEMPLATE(name, 3); \
+    BENCHMARK_TEMPLATE(name, 7); \
+    BENCHMARK_TEMPLATE(name, 10); \
+    BENCHMARK_TEMPLATE(name, 12)
+
+BENCHMARK_SIZES(BM_NaiveMultiply);
+BENCHMARK_SIZES(BM_UnrolledMultiply);
+BENCHMARK_SIZES(BM_NaiveJacobianTranspose);
+BENCHMARK_SIZES(BM_UnrolledJacobianTranspose);
+BENCHMARK_SIZES(BM_NaiveNormalEquations);
+BENCHMARK_SIZES(BM_UnrolledNormalEquations);
+BENCHMARK_SIZES(BM_NaiveCholeskySolve);
+BENCHMARK_SIZES(BM_CholeskySolve);
+BENCHMARK_SIZES(BM_LDLTSolve);
+
+BENCHMARK_MAIN();
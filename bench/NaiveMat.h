@@ -0,0 +1,225 @@
+#ifndef NAIVEMAT_H_
+#define NAIVEMAT_H_
+
+#include <string>
+#include <sstream>
+#include <cmath>
+
+namespace arm_slam
+{
+    // BasicMat as it was before the unrolled kernels, generic loops and
+    // copying operators included, kept as the baseline for
+    // BasicMatBenchmark.
+  template <size_t N, size_t M> class NaiveMat
+    {
+        public:
+            typedef NaiveMat<N, M> Type;
+            NaiveMat()
+            {
+                   for(size_t i = 0; i < N * M; i++)
+                   {
+                       m[i] = 0.0f;
+                   }
+            }
+
+            ~NaiveMat()
+            {
+
+            }
+
+            inline std::string ToString()
+            {
+                std::stringstream ss;
+
+                for (size_t r = 0; r < N; r++)
+                {
+                    for (size_t c = 0; c < M; c++)
+                    {
+                        ss << (*this)(r, c) << " ";
+                    }
+
+                    ss << "\n";
+                }
+
+                return ss.str();
+            }
+
+            inline size_t GetNumRows()
+            {
+                return N;
+            }
+
+            inline size_t GetNumCols()
+            {
+                return M;
+            }
+
+            float& operator[](size_t idx)
+            {
+                return m[idx];
+            }
+
+            const float& operator[](size_t idx) const
+            {
+                return m[idx];
+            }
+
+            float& operator()(size_t r, size_t c = 0)
+            {
+                return (*this)[r * M + c];
+            }
+
+            const float& operator()(size_t r, size_t c  = 0) const
+            {
+                return (*this)[r * M + c];
+            }
+
+            void operator=(const Type& other)
+            {
+                for(size_t i = 0; i < N * M; i++)
+                 {
+                     m[i] = other[i];
+                 }
+            }
+
+            /*
+            Type operator=(const Type& other)
+            {
+                Type toReturn = *this;
+                for(size_t i = 0; i < N * M; i++)
+                {
+                    toReturn[i] = other[i];
+                }
+                return toReturn;
+            }
+            */
+
+            void operator+=(const Type& other)
+            {
+                for(size_t i = 0; i < N * M; i++)
+                {
+                    m[i] += other[i];
+                }
+            }
+
+            friend Type operator+(Type lhs, const Type& rhs)
+            {
+                Type toReturn = lhs;
+                toReturn += rhs;
+                return toReturn;
+            }
+
+            Type operator*=(const float scalar)
+            {
+                Type toReturn = *this;
+                for(size_t i = 0; i < N * M; i++)
+                {
+                    toReturn[i] *= scalar;
+                }
+                return toReturn;
+            }
+
+            friend Type operator*(Type lhs, const float& rhs)
+            {
+                return lhs *= rhs;
+            }
+
+            inline NaiveMat<M, N> Transpose() const
+            {
+                NaiveMat<M, N> toReturn;
+
+                for(size_t r = 0; r < N; r++)
+                {
+                    for(size_t c = 0; c < M; c++)
+                    {
+                        toReturn(c, r) = (*this)(r, c);
+                    }
+                }
+                return toReturn;
+            }
+
+            template <size_t M2> NaiveMat<N, M2> PostMult(const NaiveMat<M, M2>& rhs)
+            {
+                NaiveMat<N, M2> toReturn;
+
+                for (size_t r = 0; r < N; r++)
+                {
+                    for(size_t c = 0; c < M2; c++)
+                    {
+                        for(size_t k = 0; k < M; k++)
+                        {
+                            toReturn(r, c) += (*this)(r, k) * rhs(k, c);
+                        }
+                    }
+                }
+                return toReturn;
+            }
+
+            // Solves (*this) x = b for a symmetric positive definite matrix
+            // by Cholesky factorization. Returns false if the matrix is not
+            // positive definite.
+            bool CholeskySolve(const NaiveMat<N, 1>& b, NaiveMat<N, 1>& x) const
+            {
+                NaiveMat<N, N> L;
+                for (size_t c = 0; c < N; c++)
+                {
+                    float diag = (*this)(c, c);
+                    for (size_t k = 0; k < c; k++)
+                    {
+                        diag -= L(c, k) * L(c, k);
+                    }
+                    if (!(diag > 0.0f))
+                    {
+                        return false;
+                    }
+                    L(c, c) = sqrtf(diag);
+                    for (size_t r = c + 1; r < N; r++)
+                    {
+                        float sum = (*this)(r, c);
+                        for (size_t k = 0; k < c; k++)
+                        {
+                            sum -= L(r, k) * L(c, k);
+                        }
+                        L(r, c) = sum / L(c, c);
+                    }
+                }
+
+                NaiveMat<N, 1> y;
+                for (size_t r = 0; r < N; r++)
+                {
+                    float sum = b[r];
+                    for (size_t k = 0; k < r; k++)
+                    {
+                        sum -= L(r, k) * y[k];
+                    }
+                    y[r] = sum / L(r, r);
+                }
+
+                for (size_t r = N; r-- > 0;)
+                {
+                    float sum = y[r];
+                    for (size_t k = r + 1; k < N; k++)
+                    {
+                        sum -= L(k, r) * x[k];
+                    }
+                    x[r] = sum / L(r, r);
+                }
+                return true;
+            }
+
+            template <size_t M2> NaiveMat<N, M2> operator*=(const NaiveMat<M, M2>& rhs)
+            {
+                return PostMult(rhs);
+            }
+
+            template <size_t M2> friend NaiveMat<N, M2> operator*(Type lhs, const NaiveMat<M, M2>& rhs)
+            {
+                return lhs *= rhs;
+            }
+
+            float m[N * M];
+    };
+
+}
+
+#endif // NAIVEMAT_H_ 
@@ -0,0 +1,215 @@
+// Benchmarks the per step kernels of the tracking and mapping pipeline on
+// a synthetic world: a walled square of mapSize cells with a few boxes in
+// it, seen by an arm in the middle. Arguments are named after the knobs
+// they sweep; the arm's DOF is a template parameter.
+#include <benchmark/benchmark.h>
+#include "ofMain.h"
+#include "World.h"
+#include "TSDF.h"
+#include "Robot.h"
+#include "DepthCamera.h"
+
+using arm_slam::World;
+using arm_slam::TSDF;
+using arm_slam::Robot;
+
+// Fills world.data with a one cell wall around the border and a box in
+// each quadrant, then builds the world's distance fields.
+static void MakeWorld(World& world, int size)
+{
+    world.data.allocate(size, size, OF_IMAGE_COLOR);
+    const ofColor free(255, 255, 255);
+    const ofColor wall(0, 0, 0);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            const bool border = x == 0 || y == 0 || x == size - 1 || y == size - 1;
+            const int bx = (x * 4 / size) & 1;
+            const int by = (y * 4 / size) & 1;
+            const int cx = x % (size / 4);
+            const int cy = y % (size / 4);
+            const bool box = bx == by && cx > size / 16 && cx < size / 8 && cy > size / 16 && cy < size / 8;
+            world.data.setColor(x, y, border || box ? wall : free);
+        }
+    }
+    world.Initialize(1);
+}
+
+// A world, an arm of N joints with its base in the middle and reaching a
+// quarter of the way to the walls, and a map fused from a full turn of the
+// arm.
+template <size_t N> struct Scene
+{
+    Scene(int size, int beams, float truncation)
+    {
+        MakeWorld(world, size);
+        float lengths[N + 1];
+        for (size_t i = 0; i < N; i++)
+        {
+            lengths[i] = 0.25f * size / N;
+        }
+        lengths[N] = 0.0f;
+        robot.Initialize(lengths);
+        robot.SetBase(ofVec2f(size / 2, size / 2));
+        robot.camera->resolution = (robot.camera->maxAngle - robot.camera->minAngle) / beams;
+
+        tsdf.Initialize(world, truncation);
+        typename Robot<N>::Config q;
+        for (int i = 0; i < 32; i++)
+        {
+            q[0] = i * 2.0f * (float)M_PI / 32;
+            robot.SetQ(q);
+            Scan();
+            tsdf.FuseRayCloud(robot.camera->globalTranslation, robot.camera->globalRotation, robot.camera->noisyPoints, robot.camera->gradients);
+        }
+        q[0] = 0.3f;
+        robot.SetQ(q);
+        Scan();
+    }
+
+    void Scan()
+    {
+        robot.Update(world);
+        robot.camera->ComputeGradients(world, false);
+    }
+
+    World world;
+    TSDF tsdf;
+    Robot<N> robot;
+};
+
+static void BM_DepthCameraUpdate(benchmark::State& state)
+{
+    Scene<3> scene(state.range(0), state.range(1), 32.0f);
+    for (auto _ : state)
+    {
+        scene.robot.camera->Update(scene.world);
+        benchmark::DoNotOptimize(scene.robot.camera->points.data());
+    }
+    state.SetItemsProcessed(state.iterations() * scene.robot.camera->points.size());
+}
+
+static void BM_ComputeGradients(benchmark::State& state)
+{
+    Scene<3> scene(state.range(0), state.range(1), 32.0f);
+    for (auto _ : state)
+    {
+        scene.robot.camera->ComputeGradients(scene.tsdf, true);
+        benchmark::DoNotOptimize(scene.robot.camera->gradients.data());
+    }
+    state.SetItemsProcessed(state.iterations() * scene.robot.camera->noisyPoints.size());
+}
+
+static void BM_FuseRayCloud(benchmark::State& state)
+{
+    Scene<3> scene(state.range(0), state.range(1), state.range(2));
+    scene.robot.camera->ComputeGradients(scene.world, false);
+    const arm_slam::DepthCamera& camera = *scene.robot.camera;
+    for (auto _ : state)
+    {
+        scene.tsdf.FuseRayCloud(camera.globalTranslation, camera.globalRotation, camera.noisyPoints, camera.gradients);
+    }
+    state.SetItemsProcessed(state.iterations() * camera.noisyPoints.size());
+}
+
+static void BM_SetColors(benchmark::State& state)
+{
+    Scene<3> scene(state.range(0), 64, 32.0f);
+    ofImage img;
+    img.allocate(scene.tsdf.width, scene.tsdf.height, OF_IMAGE_COLOR);
+    img.setUseTexture(false);
+    for (auto _ : state)
+    {
+        scene.tsdf.SetColors(&img);
+    }
+    state.SetItemsProcessed(state.iterations() * scene.tsdf.cells.size());
+}
+
+static void BM_ComputeError(benchmark::State& state)
+{
+    Scene<3> scene(state.range(0), 64, state.range(1));
+    for (auto _ : state)
+    {
+        float classificationError;
+        float tsdfError;
+        scene.tsdf.ComputeError(scene.world, classificationError, tsdfError);
+        benchmark::DoNotOptimize(classificationError);
+    }
+    state.SetItemsProcessed(state.iterations() * scene.tsdf.cells.size());
+}
+
+// Iterations of descent from a configuration 0.05 rad off on every joint.
+template <size_t N> static void BM_GradientDescent(benchmark::State& state)
+{
+    Scene<N> scene(state.range(0), state.range(1), 32.0f);
+    typename Robot<N>::Config start = scene.robot.GetQ();
+    for (size_t k = 0; k < N; k++)
+    {
+        start[k] += 0.05f;
+    }
+    for (auto _ : state)
+    {
+        scene.robot.SetQ(start);
+        scene.robot.UpdateKinematics();
+        scene.robot.camera->ComputeGradients(scene.tsdf, true);
+        scene.robot.GradientDescent(10, 0.001f, scene.tsdf);
+        benchmark::DoNotOptimize(scene.robot.GetQ());
+    }
+}
+
+static void BM_FreeGradientDescent(benchmark::State& state)
+{
+    Scene<3> scene(state.range(0), state.range(1), 32.0f);
+    arm_slam::DepthCamera camera;
+    camera.noisyPoints = scene.robot.camera->noisyPoints;
+    for (auto _ : state)
+    {
+        camera.globalTranslation = scene.robot.camera->globalTranslation + ofVec2f(2.0f, -2.0f);
+        camera.globalRotation = scene.robot.camera->globalRotation + 0.02f;
+        camera.ComputeGradients(scene.tsdf, true);
+        camera.FreeGradientDescent(scene.tsdf, 10, 0.001f, 1e-5f);
+        benchmark::DoNotOptimize(camera.globalTranslation);
+    }
+}
+
+// mapSize x beams.
+static void MapAndBeams(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({"mapSize", "beams"});
+    for (int size : {256, 512, 1024})
+    {
+        for (int beams : {60, 240})
+        {
+            b->Args({size, beams});
+        }
+    }
+}
+
+// mapSize x beams x truncation.
+static void MapBeamsAndTruncation(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({"mapSize", "beams", "truncation"});
+    for (int size : {256, 1024})
+    {
+        for (int beams : {60, 240})
+        {
+            for (int truncation : {8, 32})
+            {
+                b->Args({size, beams, truncation});
+            }
+        }
+    }
+}
+
+BENCHMARK(BM_DepthCameraUpdate)->Apply(MapAndBeams);
+BENCHMARK(BM_ComputeGradients)->Apply(MapAndBeams);
+BENCHMARK(BM_FuseRayCloud)->Apply(MapBeamsAndTruncation);
+BENCHMARK(BM_SetColors)->ArgName("mapSize")->Arg(256)->Arg(512)->Arg(1024);
+BENCHMARK(BM_ComputeError)->ArgNames({"mapSize", "truncation"})->Args({256, 32})->Args({512, 32})->Args({1024, 8})->Args({1024, 32});
+BENCHMARK_TEMPLATE(BM_GradientDescent, 3)->Apply(MapAndBeams);
+BENCHMARK_TEMPLATE(BM_GradientDescent, 6)->Apply(MapAndBeams);
+BENCHMARK_TEMPLATE(BM_GradientDescent, 12)->Apply(MapAndBeams);
+BENCHMARK(BM_FreeGradientDescent)->Apply(MapAndBeams);
+
+BENCHMARK_MAIN();
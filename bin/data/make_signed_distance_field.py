@@ -1,19 +0,0 @@
-import scipy;
-import scipy.ndimage as img;
-import scipy.ndimage.morphology;
-import matplotlib.pyplot as plt;
-import numpy;
-world = img.imread('./world.png');
-neg_world = numpy.invert(world);
-pos_dist = img.morphology.distance_transform_edt(world);
-neg_dist = img.morphology.distance_transform_edt(neg_world);
-#plt.imshow(pos_dist / 255.0);
-#plt.imshow(neg_dist / 255.0);
-#plt.show();
-[rows, cols, channels] = world.shape;
-saveImg = numpy.copy(world);
-saveImg[:, :, 0] = pos_dist[:, :, 0];
-saveImg[:, :, 1] = neg_dist[:, :, 1];
-scipy.misc.imsave('./dist.png', saveImg);
-#plt.imshow(saveImg);
-#plt.show();
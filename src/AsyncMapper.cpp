@@ -0,0 +1,207 @@
+#include "AsyncMapper.h"
+#include "Profiler.h"
+#include <cstring>
+#include <algorithm>
+
+namespace arm_slam
+{
+
+    AsyncMapper::AsyncMapper() :
+            numDropped(0),
+            numStalls(0),
+            map(NULL),
+            maxLag(1),
+            blocking(false),
+            cachedGradients(false),
+            sleeping(false),
+            numSubmitted(0),
+            numFused(0),
+            stopping(false)
+    {
+
+    }
+
+    AsyncMapper::~AsyncMapper()
+    {
+        Stop();
+    }
+
+    void AsyncMapper::Start(TSDF& map_, size_t queueSize, bool blocking_)
+    {
+        Stop();
+        map = &map_;
+        cachedGradients = map->cachedGradients;
+        map->cachedGradients = false;
+        maxLag = std::max(queueSize, (size_t)1);
+        blocking = blocking_;
+        queue.Reset(maxLag);
+        buffers.clear();
+        std::atomic_store(&snapshot, std::shared_ptr<TSDF>());
+        numDropped = 0;
+        numStalls = 0;
+        numSubmitted = 0;
+        numFused = 0;
+        stopping = false;
+        sleeping = false;
+        Publish();
+        worker = std::thread(&AsyncMapper::WorkerLoop, this);
+    }
+
+    void AsyncMapper::Stop()
+    {
+        if (!worker.joinable())
+        {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+        map->cachedGradients = cachedGradients;
+    }
+
+    bool AsyncMapper::Submit(const Scan& scan)
+    {
+        // Scans popped but not yet published are no longer queued, so the
+        // queue has room whenever the snapshot is less than maxLag behind.
+        if (GetLag() >= maxLag)
+        {
+            if (!blocking)
+            {
+                numDropped++;
+                return false;
+            }
+            ARM_SLAM_PROFILE_SCOPE("stall");
+            numStalls++;
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return GetLag() < maxLag; });
+        }
+        queue.TryPush(scan);
+        numSubmitted++;
+
+        // Pairs with the fence in WorkerLoop: either the mapping thread sees
+        // the scan before it sleeps, or this sees it sleeping.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed))
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.notify_all();
+        }
+        return true;
+    }
+
+    void AsyncMapper::Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return GetLag() == 0 || !worker.joinable(); });
+    }
+
+    std::shared_ptr<TSDF> AsyncMapper::GetSnapshot() const
+    {
+        return std::atomic_load(&snapshot);
+    }
+
+    void AsyncMapper::WorkerLoop()
+    {
+        Scan scan;
+        while (true)
+        {
+            size_t numScans = 0;
+            while (queue.TryPop(scan))
+            {
+                ARM_SLAM_PROFILE_SCOPE("mapping");
+                map->FuseRayCloud(scan.origin, scan.rotation, scan.points, scan.gradients);
+                numScans++;
+            }
+
+            if (numScans > 0)
+            {
+                ARM_SLAM_PROFILE_SCOPE("publish");
+                Publish();
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            numFused += numScans;
+            changed.notify_all();
+            if (stopping && queue.IsEmpty())
+            {
+                return;
+            }
+
+            sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            changed.wait(lock, [this] { return stopping || !queue.IsEmpty(); });
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void AsyncMapper::Publish()
+    {
+        // A buffer only the pool holds can't be picked up again by the
+        // tracker, since it isn't the published one.
+        const std::shared_ptr<TSDF> published = std::atomic_load(&snapshot);
+        std::shared_ptr<TSDF> buffer;
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            if (buffers[i] != published && buffers[i].use_count() == 1)
+            {
+                buffer = buffers[i];
+                break;
+            }
+        }
+        if (!buffer)
+        {
+            buffer = std::make_shared<TSDF>();
+            buffers.push_back(buffer);
+        }
+        // Order the tracker's last reads of the buffer before the writes below.
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // A recycled buffer is a copy of map as of its version, so only the
+        // tiles stamped since need copying.
+        uint32_t since = buffer->version;
+        if (buffer->width != map->width || buffer->height != map->height || buffer->cells.size() != map->cells.size())
+        {
+            buffer->Initialize(map->width, map->height, map->truncation);
+            since = 0;
+        }
+        buffer->truncation = map->truncation;
+        buffer->interpolatedSampling = map->interpolatedSampling;
+        buffer->cachedGradients = cachedGradients;
+        buffer->readOnly = true;
+
+        const uint32_t upTo = map->Checkpoint();
+        for (int ty = 0; ty < map->tilesHigh; ty++)
+        {
+            for (int tx = 0; tx < map->tilesWide; tx++)
+            {
+                const int t = tx + ty * map->tilesWide;
+                if (!map->IsTileChanged(t, since, upTo))
+                {
+                    continue;
+                }
+
+                const int x0 = tx << TSDF::TILE_SHIFT;
+                const int x1 = std::min(x0 + TSDF::TILE_SIZE, map->width);
+                const int y1 = std::min((ty + 1) << TSDF::TILE_SHIFT, map->height);
+                for (int y = ty << TSDF::TILE_SHIFT; y < y1; y++)
+                {
+                    const int idx = map->GetIdx(x0, y);
+                    memcpy(&buffer->cells[idx], &map->cells[idx], (x1 - x0) * sizeof(TSDF::Cell));
+                }
+                buffer->tileVersions[t] = map->tileVersions[t];
+            }
+        }
+        buffer->version = upTo;
+
+        if (buffer->interpolatedSampling && buffer->cachedGradients)
+        {
+            buffer->UpdateGradientField();
+        }
+        std::atomic_store(&snapshot, buffer);
+    }
+
+}
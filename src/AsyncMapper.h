@@ -0,0 +1,106 @@
+#ifndef ASYNCMAPPER_H_
+#define ASYNCMAPPER_H_
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "ofMain.h"
+#include "TSDF.h"
+#include "SPSCQueue.h"
+
+namespace arm_slam
+{
+    // Fuses scans into a dense TSDF on a mapping thread, so tracking never
+    // waits on fusion. The tracking thread submits scans through a lock free
+    // queue and tracks on the latest snapshot: a read only copy of the map
+    // that the mapping thread refreshes, only in the tiles changed, after
+    // each batch of scans it fuses. Snapshots are shared pointers and their
+    // buffers are recycled once the tracker lets go of them, so two or three
+    // buffers take turns and nothing is allocated in steady state.
+    class AsyncMapper
+    {
+        public:
+            // A scan to fuse, as the arguments of TSDF::FuseRayCloud.
+            struct Scan
+            {
+                    ofVec2f origin;
+                    float rotation;
+                    std::vector<ofVec2f> points;
+                    std::vector<ofVec2f> gradients;
+            };
+
+            AsyncMapper();
+            virtual ~AsyncMapper();
+
+            // Publishes a first snapshot of map and starts fusing into it.
+            // Until Stop, map belongs to the mapping thread: read it only
+            // after Wait, or through snapshots. The latest snapshot is at
+            // most queueSize scans behind; see Submit.
+            void Start(TSDF& map, size_t queueSize, bool blocking = false);
+            // Fuses the scans still queued, then joins the mapping thread.
+            void Stop();
+            inline bool IsRunning() const
+            {
+                return worker.joinable();
+            }
+
+            // Tracking thread only. Queues a copy of scan. If the latest
+            // snapshot is already queueSize scans behind, drops scan and
+            // returns false, or, if Start was asked to block, first waits
+            // for the mapping thread to catch up.
+            bool Submit(const Scan& scan);
+            // Blocks until every submitted scan is fused and published.
+            void Wait();
+
+            // Tracking thread only. Scans submitted but not yet in the latest
+            // snapshot. Read before GetSnapshot, it bounds the lag of the
+            // snapshot returned.
+            inline size_t GetLag() const
+            {
+                return numSubmitted - numFused.load();
+            }
+
+            // The latest snapshot. Snapshots are marked TSDF::readOnly, so
+            // tile versioned consumers such as TSDFPyramid or
+            // TSDFColorizer can follow one snapshot after another as if they
+            // were the map itself. Don't write to them.
+            std::shared_ptr<TSDF> GetSnapshot() const;
+
+            // Scans Submit dropped, and scans it waited to queue.
+            size_t numDropped;
+            size_t numStalls;
+
+        protected:
+            void WorkerLoop();
+            // Copies the tiles of map changed since a free buffer was last
+            // published into it, and publishes it.
+            void Publish();
+
+            TSDF* map;
+            size_t maxLag;
+            bool blocking;
+            // Whether snapshots keep a gradient field. map's own is turned
+            // off while it belongs to the mapping thread, since nothing
+            // samples it then.
+            bool cachedGradients;
+            SPSCQueue<Scan> queue;
+            std::vector<std::shared_ptr<TSDF> > buffers;
+            std::shared_ptr<TSDF> snapshot;
+            // Set by the mapping thread while it waits for scans, so Submit
+            // only takes the lock to wake it.
+            std::atomic<bool> sleeping;
+            std::thread worker;
+            std::mutex mutex;
+            std::condition_variable changed;
+            size_t numSubmitted;
+            // Scans in the latest snapshot; written by the mapping thread
+            // under mutex, after it publishes them.
+            std::atomic<size_t> numFused;
+            bool stopping;
+    };
+}
+
+#endif // ASYNCMAPPER_H_
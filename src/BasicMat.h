@@ -3,13 +3,93 @@
 
 #include <string>
 #include <sstream>
+#include <cmath>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+// Inlines every call in the function, lambdas included, however deep.
+#if defined(__GNUC__)
+#define ARM_SLAM_FLATTEN __attribute__((flatten))
+#else
+#define ARM_SLAM_FLATTEN
+#endif
 
 namespace arm_slam
 {
+    // Sum of a[k * SA] * b[k * SB] for k < K, unrolled at compile time.
+    // Terms are added in increasing k, like a plain loop.
+    template <size_t K, size_t SA, size_t SB> struct UnrolledDot
+    {
+        static inline float Run(const float* a, const float* b)
+        {
+            return UnrolledDot<K - 1, SA, SB>::Run(a, b) + a[(K - 1) * SA] * b[(K - 1) * SB];
+        }
+    };
+
+    template <size_t SA, size_t SB> struct UnrolledDot<0, SA, SB>
+    {
+        static inline float Run(const float*, const float*)
+        {
+            return 0.0f;
+        }
+    };
+
+    // Calls f(0) ... f(K - 1), unrolled at compile time.
+    template <size_t K> struct Unrolled
+    {
+        template <typename F> static inline void Run(const F& f)
+        {
+            Unrolled<K - 1>::Run(f);
+            f(K - 1);
+        }
+    };
+
+    template <> struct Unrolled<0>
+    {
+        template <typename F> static inline void Run(const F&)
+        {
+
+        }
+    };
+
+    // Calls f(k) for begin <= k < end <= K, unrolled at compile time if
+    // unroll is set, otherwise as a plain loop. Unrolled, constant bounds
+    // fold away and the calls compile to straight line code.
+    template <size_t K, bool unroll> struct RangeLoop
+    {
+        template <typename F> static inline void Run(size_t begin, size_t end, const F& f)
+        {
+            for (size_t k = begin; k < end; k++)
+            {
+                f(k);
+            }
+        }
+    };
+
+    template <size_t K> struct RangeLoop<K, true>
+    {
+        template <typename F> static inline void Run(size_t begin, size_t end, const F& f)
+        {
+            Unrolled<K>::Run([&](size_t k)
+            {
+                if (k >= begin && k < end)
+                {
+                    f(k);
+                }
+            });
+        }
+    };
+
   template <size_t N, size_t M> class BasicMat
     {
         public:
             typedef BasicMat<N, M> Type;
+            // Factorizations and solves are unrolled up to this size, the
+            // largest benchmarked; past it the code size grows quadratically.
+            static const size_t MAX_UNROLLED_SOLVE = 12;
+            typedef RangeLoop<N, N <= MAX_UNROLLED_SOLVE> SolveLoop;
+
             BasicMat()
             {
                    for(size_t i = 0; i < N * M; i++)
@@ -23,6 +103,16 @@ namespace arm_slam
 
             }
 
+            static Type Identity()
+            {
+                Type toReturn;
+                for(size_t i = 0; i < N && i < M; i++)
+                {
+                    toReturn(i, i) = 1.0f;
+                }
+                return toReturn;
+            }
+
             inline std::string ToString()
             {
                 std::stringstream ss;
@@ -70,49 +160,36 @@ namespace arm_slam
                 return (*this)[r * M + c];
             }
 
-            void operator=(const Type& other)
-            {
-                for(size_t i = 0; i < N * M; i++)
-                 {
-                     m[i] = other[i];
-                 }
-            }
-
-            /*
-            Type operator=(const Type& other)
+            Type& operator=(const Type& other)
             {
-                Type toReturn = *this;
                 for(size_t i = 0; i < N * M; i++)
                 {
-                    toReturn[i] = other[i];
+                    m[i] = other[i];
                 }
-                return toReturn;
+                return *this;
             }
-            */
 
-            void operator+=(const Type& other)
+            Type& operator+=(const Type& other)
             {
                 for(size_t i = 0; i < N * M; i++)
                 {
                     m[i] += other[i];
                 }
+                return *this;
             }
 
             friend Type operator+(Type lhs, const Type& rhs)
             {
-                Type toReturn = lhs;
-                toReturn += rhs;
-                return toReturn;
+                return lhs += rhs;
             }
 
-            Type operator*=(const float scalar)
+            Type& operator*=(const float scalar)
             {
-                Type toReturn = *this;
                 for(size_t i = 0; i < N * M; i++)
                 {
-                    toReturn[i] *= scalar;
+                    m[i] *= scalar;
                 }
-                return toReturn;
+                return *this;
             }
 
             friend Type operator*(Type lhs, const float& rhs)
@@ -134,53 +211,263 @@ namespace arm_slam
                 return toReturn;
             }
 
-            template <size_t N2> BasicMat<N2, M> PreMult(const BasicMat<N2, N>& lhs)
+            // lhs * (*this).
+            template <size_t N2> BasicMat<N2, M> PreMult(const BasicMat<N2, N>& lhs) const
             {
-                    BasicMat<N2, M> toReturn;
+                return lhs.PostMult(*this);
+            }
 
-                    for (size_t r = 0; r < N2; r++)
+            // (*this) * rhs.
+            template <size_t M2> BasicMat<N, M2> PostMult(const BasicMat<M, M2>& rhs) const
+            {
+                BasicMat<N, M2> toReturn;
+                for(size_t r = 0; r < N; r++)
+                {
+                    AccumulateRows<M, M2>(&m[r * M], 1, rhs.m, &toReturn.m[r * M2]);
+                }
+                return toReturn;
+            }
+
+            // Transpose() * rhs, without forming the transpose.
+            template <size_t M2> BasicMat<M, M2> TransposeMult(const BasicMat<N, M2>& rhs) const
+            {
+                BasicMat<M, M2> toReturn;
+                for(size_t r = 0; r < M; r++)
+                {
+                    AccumulateRows<N, M2>(&m[r], M, rhs.m, &toReturn.m[r * M2]);
+                }
+                return toReturn;
+            }
+
+            // (*this) * rhs.Transpose(), without forming the transpose.
+            template <size_t N2> BasicMat<N, N2> MultTranspose(const BasicMat<N2, M>& rhs) const
+            {
+                BasicMat<N, N2> toReturn;
+                Unrolled<N>::Run([&](size_t r)
+                {
+                    Unrolled<N2>::Run([&](size_t c)
                     {
-                        for(size_t c = 0; c < M; c++)
-                        {
-                            for(size_t k = 0; k < N; k++)
-                            {
-                                toReturn[r, c] += lhs(r, k) * (*this)(k, r);
-                            }
-                        }
+                        toReturn(r, c) = UnrolledDot<M, 1, 1>::Run(&m[r * M], &rhs.m[c * M]);
+                    });
+                });
+                return toReturn;
+            }
+
+            // Lower triangular L with L L^T = (*this), for a symmetric
+            // positive definite matrix. Only the lower triangle is read.
+            // Returns false if the matrix is not positive definite.
+            ARM_SLAM_FLATTEN bool CholeskyDecompose(BasicMat<N, N>& L) const
+            {
+                L = BasicMat<N, N>();
+                bool ok = true;
+                SolveLoop::Run(0, N, [&](size_t c)
+                {
+                    if (!ok)
+                    {
+                        return;
+                    }
+                    float diag = (*this)(c, c);
+                    SolveLoop::Run(0, c, [&](size_t k)
+                    {
+                        diag -= L(c, k) * L(c, k);
+                    });
+                    if (!(diag > 0.0f))
+                    {
+                        ok = false;
+                        return;
                     }
-                    return toReturn;
+                    L(c, c) = sqrtf(diag);
+                    SolveLoop::Run(c + 1, N, [&](size_t r)
+                    {
+                        float sum = (*this)(r, c);
+                        SolveLoop::Run(0, c, [&](size_t k)
+                        {
+                            sum -= L(r, k) * L(c, k);
+                        });
+                        L(r, c) = sum / L(c, c);
+                    });
+                });
+                return ok;
             }
 
-            template <size_t M2> BasicMat<N, M2> PostMult(const BasicMat<M, M2>& rhs)
+            // Solves (*this) x = b for a symmetric positive definite matrix.
+            // Returns false if the matrix is not positive definite.
+            ARM_SLAM_FLATTEN bool CholeskySolve(const BasicMat<N, 1>& b, BasicMat<N, 1>& x) const
             {
-                BasicMat<N, M2> toReturn;
+                BasicMat<N, N> L;
+                if (!CholeskyDecompose(L))
+                {
+                    return false;
+                }
 
-                for (size_t r = 0; r < N; r++)
+                BasicMat<N, 1> y;
+                SolveLoop::Run(0, N, [&](size_t r)
                 {
-                    for(size_t c = 0; c < M2; c++)
+                    float sum = b[r];
+                    SolveLoop::Run(0, r, [&](size_t k)
                     {
-                        for(size_t k = 0; k < M; k++)
-                        {
-                            toReturn(r, c) += (*this)(r, k) * rhs(k, c);
-                        }
+                        sum -= L(r, k) * y[k];
+                    });
+                    y[r] = sum / L(r, r);
+                });
+
+                SolveLoop::Run(0, N, [&](size_t i)
+                {
+                    const size_t r = N - 1 - i;
+                    float sum = y[r];
+                    SolveLoop::Run(r + 1, N, [&](size_t k)
+                    {
+                        sum -= L(k, r) * x[k];
+                    });
+                    x[r] = sum / L(r, r);
+                });
+                return true;
+            }
+
+            // Unit lower triangular L and diagonal D with L D L^T = (*this),
+            // for a symmetric matrix. Needs no square roots and also handles
+            // indefinite matrices, as long as no pivot is zero. Returns false
+            // on a zero pivot.
+            ARM_SLAM_FLATTEN bool LDLTDecompose(BasicMat<N, N>& L, BasicMat<N, 1>& D) const
+            {
+                L = BasicMat<N, N>::Identity();
+                bool ok = true;
+                SolveLoop::Run(0, N, [&](size_t c)
+                {
+                    if (!ok)
+                    {
+                        return;
                     }
+                    float diag = (*this)(c, c);
+                    SolveLoop::Run(0, c, [&](size_t k)
+                    {
+                        diag -= L(c, k) * L(c, k) * D[k];
+                    });
+                    if (diag == 0.0f || diag != diag)
+                    {
+                        ok = false;
+                        return;
+                    }
+                    D[c] = diag;
+                    const float inv = 1.0f / diag;
+                    SolveLoop::Run(c + 1, N, [&](size_t r)
+                    {
+                        float sum = (*this)(r, c);
+                        SolveLoop::Run(0, c, [&](size_t k)
+                        {
+                            sum -= L(r, k) * L(c, k) * D[k];
+                        });
+                        L(r, c) = sum * inv;
+                    });
+                });
+                return ok;
+            }
+
+            // Solves (*this) x = b for a symmetric matrix by LDL^T.
+            ARM_SLAM_FLATTEN bool LDLTSolve(const BasicMat<N, 1>& b, BasicMat<N, 1>& x) const
+            {
+                BasicMat<N, N> L;
+                BasicMat<N, 1> D;
+                if (!LDLTDecompose(L, D))
+                {
+                    return false;
                 }
-                return toReturn;
+
+                BasicMat<N, 1> y;
+                SolveLoop::Run(0, N, [&](size_t r)
+                {
+                    float sum = b[r];
+                    SolveLoop::Run(0, r, [&](size_t k)
+                    {
+                        sum -= L(r, k) * y[k];
+                    });
+                    y[r] = sum;
+                });
+
+                SolveLoop::Run(0, N, [&](size_t i)
+                {
+                    const size_t r = N - 1 - i;
+                    float sum = y[r] / D[r];
+                    SolveLoop::Run(r + 1, N, [&](size_t k)
+                    {
+                        sum -= L(k, r) * x[k];
+                    });
+                    x[r] = sum;
+                });
+                return true;
             }
 
-            template <size_t M2> BasicMat<N, M2> operator*=(const BasicMat<M, M2>& rhs)
+            // In place product with a square matrix.
+            Type& operator*=(const BasicMat<M, M>& rhs)
             {
-                return PostMult(rhs);
+                return *this = PostMult(rhs);
             }
 
-            template <size_t M2> friend BasicMat<N, M2> operator*(Type lhs, const BasicMat<M, M2>& rhs)
+            template <size_t M2> friend BasicMat<N, M2> operator*(const Type& lhs, const BasicMat<M, M2>& rhs)
             {
-                return lhs *= rhs;
+                return lhs.PostMult(rhs);
             }
 
             float m[N * M];
+
+        protected:
+            // out = sum over k < K of a[k * aStride] times row k of the K x W
+            // matrix B. GCC already vectorizes the plain loop across whole
+            // vectors, so only widths that are not a multiple of four, up to
+            // 16, go through AVX registers masked to the row width with the
+            // shared dimension unrolled. Below three columns or three terms
+            // spilling the registers costs more than it saves.
+            template <size_t K, size_t W> static inline void AccumulateRows(const float* a, size_t aStride, const float* B, float* out)
+            {
+#ifdef __AVX__
+                if(W >= 3 && W <= 16 && W % 4 != 0 && K >= 3)
+                {
+                    const __m256i mask0 = GetLaneMask(W < 8 ? W : 8);
+                    const __m256i mask1 = GetLaneMask(W > 8 ? W - 8 : 0);
+                    __m256 acc0 = _mm256_setzero_ps();
+                    __m256 acc1 = _mm256_setzero_ps();
+                    Unrolled<K>::Run([&](size_t k)
+                    {
+                        const __m256 ak = _mm256_set1_ps(a[k * aStride]);
+                        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(ak, _mm256_maskload_ps(B + k * W, mask0)));
+                        if(W > 8)
+                        {
+                            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(ak, _mm256_maskload_ps(B + k * W + 8, mask1)));
+                        }
+                    });
+                    // Masked stores defeat store forwarding to the caller's
+                    // reads, so spill whole registers and copy the row.
+                    float row[16];
+                    _mm256_storeu_ps(row, acc0);
+                    _mm256_storeu_ps(row + 8, acc1);
+                    for(size_t c = 0; c < W; c++)
+                    {
+                        out[c] = row[c];
+                    }
+                    return;
+                }
+#endif
+                for(size_t c = 0; c < W; c++)
+                {
+                    float sum = 0.0f;
+                    for(size_t k = 0; k < K; k++)
+                    {
+                        sum += a[k * aStride] * B[k * W + c];
+                    }
+                    out[c] = sum;
+                }
+            }
+
+#ifdef __AVX__
+            // The first n of eight lanes set.
+            static inline __m256i GetLaneMask(size_t n)
+            {
+                static const int lanes[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+                return _mm256_loadu_si256((const __m256i*)(lanes + 8 - n));
+            }
+#endif
     };
 
 }
 
-#endif // BASICMAT_H_ 
+#endif // BASICMAT_H_
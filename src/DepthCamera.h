@@ -4,18 +4,26 @@
 #include "Node.h"
 #include "World.h"
 #include "TSDF.h"
+#include "ThreadPool.h"
 
 namespace arm_slam
 {
     class DepthCamera : public Node
     {
         public:
-            DepthCamera() : Node(), resolution(0.025f), minAngle(-0.75f), maxAngle(0.75f)
+            enum CastMode
+            {
+                Marching,
+                GridTraversal,
+                SphereTracing
+            };
+
+            DepthCamera() : Node(), resolution(0.025f), minAngle(-0.75f), maxAngle(0.75f), castMode(GridTraversal), numThreads(1)
             {
 
             }
 
-            DepthCamera(Node* _parent) : Node(), resolution(0.025f), minAngle(-0.75f), maxAngle(0.75f)
+            DepthCamera(Node* _parent) : Node(), resolution(0.025f), minAngle(-0.75f), maxAngle(0.75f), castMode(GridTraversal), numThreads(1)
             {
                 parent  = _parent;
                 parent->children.push_back(this);
@@ -30,29 +38,173 @@ namespace arm_slam
             {
                 points.clear();
                 noisyPoints.clear();
+                beamAngles.clear();
+                for(float dt = minAngle; dt < maxAngle; dt+=resolution)
+                {
+                    beamAngles.push_back(dt);
+                }
+
+                beamHits.resize(beamAngles.size());
+                ParallelFor(0, beamAngles.size(), numThreads, [this, &map](size_t begin, size_t end)
+                {
+                    for(size_t i = begin; i < end; i++)
+                    {
+                        beamHits[i] = CastBeam(map, beamAngles[i]);
+                    }
+                });
+
+                for(size_t i = 0; i < beamAngles.size(); i++)
+                {
+                    const float dl = beamHits[i];
+                    if(dl < 0)
+                    {
+                        continue;
+                    }
+                    const float dt = beamAngles[i];
+                    ofVec2f relativeP(cos(dt), -sin(dt));
+                    relativeP *= dl;
+                    points.push_back(relativeP);
+                    //relativeP *= ofRandom(0.95f, 1.05f);
+                    noisyPoints.push_back(relativeP);
+                }
+            }
+
+            // Beams Update casts, and so the most points a scan can have.
+            size_t GetNumBeams() const
+            {
+                size_t n = 0;
                 for(float dt = minAngle; dt < maxAngle; dt+=resolution)
                 {
-                    float t = globalRotation + dt;
-                    ofVec2f dir(cos(t), -sin(t));
+                    n++;
+                }
+                return n;
+            }
+
+            // Returns the distance along the beam at angle dt (relative to the
+            // camera) of the first colliding sample, or -1 if the beam leaves
+            // the map first.
+            inline float CastBeam(const arm_slam::World& map, float dt) const
+            {
+                switch(castMode)
+                {
+                    case Marching:
+                        return CastMarching(map, dt);
+                    case SphereTracing:
+                        return CastSphereTracing(map, dt);
+                    case GridTraversal:
+                    default:
+                        return CastGridTraversal(map, dt);
+                }
+            }
 
-                    for (float dl = 0; dl < map.data.getWidth() * map.data.getHeight(); dl+=1)
+            inline float CastMarching(const arm_slam::World& map, float dt) const
+            {
+                float t = globalRotation + dt;
+                ofVec2f dir(cos(t), -sin(t));
+
+                for (float dl = 0; dl < map.width * map.height; dl+=1)
+                {
+                    ofVec2f p = dir * dl + globalTranslation;
+                    if(!map.IsValid((int)p.x, (int)p.y))
+                    {
+                        break;
+                    }
+                    if(map.Collides((int)p.x, (int)p.y))
                     {
-                        ofVec2f p = dir * dl + globalTranslation;
-                        if(!map.IsValid((int)p.x, (int)p.y))
-                        {
-                            break;
-                        }
-                        if(map.Collides((int)p.x, (int)p.y))
-                        {
-                            ofVec2f relativeP(cos(dt), -sin(dt));
-                            relativeP *= dl;
-                            points.push_back(relativeP);
-                            //relativeP *= ofRandom(0.95f, 1.05f);
-                            noisyPoints.push_back(relativeP);
-                            break;
-                        }
+                        return dl;
                     }
                 }
+                return -1.0f;
+            }
+
+            // Visits the same unit-step samples as CastMarching, but walks the
+            // tile grid of the world's occupancy (Amanatides-Woo style) and
+            // jumps over every sample that provably lies inside a square of
+            // empty tiles, so it returns exactly the same hit distance. The
+            // grid's occupied padding stops the walk at the map border, so
+            // bounds are only checked once a sample collides.
+            inline float CastGridTraversal(const arm_slam::World& map, float dt) const
+            {
+                const OccupancyGrid& grid = map.occupancy;
+                const float t = globalRotation + dt;
+                const ofVec2f dir(cos(t), -sin(t));
+                const float maxDist = map.width * map.height;
+                // Keeps skipped samples away from tile borders so float
+                // rounding in the sample position can't cross them.
+                const float margin = 1e-2f;
+                const float invX = dir.x != 0 ? 1.0f / fabs(dir.x) : 1e30f;
+                const float invY = dir.y != 0 ? 1.0f / fabs(dir.y) : 1e30f;
+
+                if(!grid.IsValid((int)globalTranslation.x, (int)globalTranslation.y))
+                {
+                    return -1.0f;
+                }
+
+                float dl = 0;
+                while(dl < maxDist)
+                {
+                    ofVec2f p = dir * dl + globalTranslation;
+                    const int x = (int)p.x;
+                    const int y = (int)p.y;
+
+                    const int clearance = grid.GetTileClearance(x, y);
+                    if(clearance > 0)
+                    {
+                        const int tx = (x + OccupancyGrid::PADDING) >> OccupancyGrid::TILE_SHIFT;
+                        const int ty = (y + OccupancyGrid::PADDING) >> OccupancyGrid::TILE_SHIFT;
+                        const float minX = (float)(((tx - clearance + 1) << OccupancyGrid::TILE_SHIFT) - OccupancyGrid::PADDING);
+                        const float minY = (float)(((ty - clearance + 1) << OccupancyGrid::TILE_SHIFT) - OccupancyGrid::PADDING);
+                        const float maxX = (float)(((tx + clearance) << OccupancyGrid::TILE_SHIFT) - OccupancyGrid::PADDING);
+                        const float maxY = (float)(((ty + clearance) << OccupancyGrid::TILE_SHIFT) - OccupancyGrid::PADDING);
+                        const float exitX = (dir.x > 0 ? maxX - p.x : p.x - minX) * invX;
+                        const float exitY = (dir.y > 0 ? maxY - p.y : p.y - minY) * invY;
+                        const float skip = floor(std::min(exitX, exitY) - margin);
+                        dl += skip > 1.0f ? skip : 1.0f;
+                        continue;
+                    }
+
+                    if(grid.Get(x, y))
+                    {
+                        return grid.IsValid(x, y) ? dl : -1.0f;
+                    }
+                    dl += 1;
+                }
+                return -1.0f;
+            }
+
+            // Same samples as CastMarching, but jumps ahead by the world's
+            // signed distance to the nearest obstacle. A sample lies within
+            // sqrt(2) of its cell corner, and so does any point of an obstacle
+            // cell, so every skipped sample is at least d - 2 sqrt(2) from an
+            // obstacle and can't collide. Near surfaces this falls back to
+            // unit steps.
+            inline float CastSphereTracing(const arm_slam::World& map, float dt) const
+            {
+                const float t = globalRotation + dt;
+                const ofVec2f dir(cos(t), -sin(t));
+                const float maxDist = map.width * map.height;
+                const float cellSlack = 3.0f;
+
+                float dl = 0;
+                while(dl < maxDist)
+                {
+                    ofVec2f p = dir * dl + globalTranslation;
+                    const int x = (int)p.x;
+                    const int y = (int)p.y;
+                    if(!map.IsValid(x, y))
+                    {
+                        break;
+                    }
+
+                    if(map.occupancy.Get(x, y))
+                    {
+                        return dl;
+                    }
+
+                    const float skip = floor(map.GetDistUnchecked(x, y) - cellSlack);
+                    dl += skip > 1.0f ? skip : 1.0f;
+                }
+                return -1.0f;
             }
 
             template <typename T> void ComputeGradients(T& map, bool noisy)
@@ -71,10 +223,21 @@ namespace arm_slam
             template <typename T> void ComputeGradients(T& map, const std::vector<ofVec2f>& pts)
             {
                 gradients.clear();
-                for(size_t i = 0; i < pts.size(); i++)
+                if(map.IsSamplingInterpolated())
                 {
-                    ofVec2f global = globalTranslation + pts[i].getRotatedRad(-globalRotation);
-                    gradients.push_back(map.GetGradient((int)global.x, (int)global.y));
+                    for(size_t i = 0; i < pts.size(); i++)
+                    {
+                        ofVec2f global = globalTranslation + pts[i].getRotatedRad(-globalRotation);
+                        gradients.push_back(map.SampleGradient(global.x, global.y));
+                    }
+                }
+                else
+                {
+                    for(size_t i = 0; i < pts.size(); i++)
+                    {
+                        ofVec2f global = globalTranslation + pts[i].getRotatedRad(-globalRotation);
+                        gradients.push_back(map.GetGradient((int)global.x, (int)global.y));
+                    }
                 }
             }
 
@@ -140,6 +303,11 @@ namespace arm_slam
             float resolution;
             float minAngle;
             float maxAngle;
+            CastMode castMode;
+            // Threads used to cast beams in Update; 0 uses every core.
+            size_t numThreads;
+            std::vector<float> beamAngles;
+            std::vector<float> beamHits;
     };
 }
 #endif // DEPTHCAMERA_H_
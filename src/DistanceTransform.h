@@ -0,0 +1,121 @@
+#ifndef DISTANCETRANSFORM_H_
+#define DISTANCETRANSFORM_H_
+
+#include <vector>
+#include <cmath>
+#include "ThreadPool.h"
+
+namespace arm_slam
+{
+    // Exact Euclidean distance transform (Felzenszwalb & Huttenlocher,
+    // "Distance Transforms of Sampled Functions"). Separable: one 1D lower
+    // envelope pass down every column, then one along every row.
+    class DistanceTransform
+    {
+        public:
+            // grid holds 0 at seed cells and a large value elsewhere. On return
+            // it holds the squared distance of every cell to its nearest seed.
+            static void ComputeSquared(std::vector<float>& grid, int w, int h, size_t numThreads)
+            {
+                ParallelFor(0, w, numThreads, [&grid, w, h](size_t begin, size_t end)
+                {
+                    std::vector<float> f(h);
+                    std::vector<float> d(h);
+                    std::vector<int> v(h);
+                    std::vector<float> z(h + 1);
+                    for(size_t x = begin; x < end; x++)
+                    {
+                        for(int y = 0; y < h; y++)
+                        {
+                            f[y] = grid[x + y * w];
+                        }
+                        Compute1D(&f[0], h, &d[0], &v[0], &z[0]);
+                        for(int y = 0; y < h; y++)
+                        {
+                            grid[x + y * w] = d[y];
+                        }
+                    }
+                });
+
+                ParallelFor(0, h, numThreads, [&grid, w](size_t begin, size_t end)
+                {
+                    std::vector<float> d(w);
+                    std::vector<int> v(w);
+                    std::vector<float> z(w + 1);
+                    for(size_t y = begin; y < end; y++)
+                    {
+                        float* row = &grid[y * w];
+                        Compute1D(row, w, &d[0], &v[0], &z[0]);
+                        std::copy(d.begin(), d.end(), row);
+                    }
+                });
+            }
+
+            // Distance from each free cell to the nearest occupied cell, minus
+            // the distance from each occupied cell to the nearest free cell.
+            static void ComputeSigned(const std::vector<unsigned char>& occupied, int w, int h, std::vector<float>& out, size_t numThreads)
+            {
+                const float far = (float)(w + h) * (float)(w + h);
+                std::vector<float> outside(w * h);
+                std::vector<float> inside(w * h);
+                for(int i = 0; i < w * h; i++)
+                {
+                    outside[i] = occupied[i] ? 0.0f : far;
+                    inside[i] = occupied[i] ? far : 0.0f;
+                }
+
+                ComputeSquared(outside, w, h, numThreads);
+                ComputeSquared(inside, w, h, numThreads);
+
+                out.resize(w * h);
+                for(int i = 0; i < w * h; i++)
+                {
+                    out[i] = sqrtf(outside[i]) - sqrtf(inside[i]);
+                }
+            }
+
+        protected:
+            // Lower envelope of the parabolas rooted at (q, f[q]). v and z are
+            // scratch buffers of size n and n + 1.
+            static void Compute1D(const float* f, int n, float* d, int* v, float* z)
+            {
+                int k = 0;
+                v[0] = 0;
+                z[0] = -INFINITY;
+                z[1] = INFINITY;
+                for(int q = 1; q < n; q++)
+                {
+                    float s = Intersect(f, q, v[k]);
+                    while(s <= z[k])
+                    {
+                        k--;
+                        s = Intersect(f, q, v[k]);
+                    }
+                    k++;
+                    v[k] = q;
+                    z[k] = s;
+                    z[k + 1] = INFINITY;
+                }
+
+                k = 0;
+                for(int q = 0; q < n; q++)
+                {
+                    while(z[k + 1] < q)
+                    {
+                        k++;
+                    }
+                    float dq = (float)(q - v[k]);
+                    d[q] = dq * dq + f[v[k]];
+                }
+            }
+
+            // Double precision keeps the envelope exact for maps tens of
+            // thousands of cells across.
+            static inline float Intersect(const float* f, int q, int p)
+            {
+                return (float)((((double)f[q] + (double)q * q) - ((double)f[p] + (double)p * p)) / (2.0 * (q - p)));
+            }
+    };
+}
+
+#endif // DISTANCETRANSFORM_H_
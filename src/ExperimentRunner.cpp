@@ -0,0 +1,645 @@
+#include "ExperimentRunner.h"
+#include "Definitions.h"
+#include "Profiler.h"
+#include <chrono>
+#include <sstream>
+
+namespace arm_slam
+{
+
+    ExperimentRunner::Params::Params() :
+            mode(ConstrainedDescent),
+            jointNoiseScale(0.25f),
+            truncation(32.0f),
+            descentIters(100),
+            descentRate(-1e-7),
+            gaussNewtonIters(5),
+            gaussNewtonLambda(1.0f),
+            gaussNewtonTolerance(1e-5f),
+            particles(256),
+            particleMotionNoise(0.05f),
+            particleMinMotionNoise(0.001f),
+            particleSigma(8.0f),
+            particleThreads(1),
+            freeDescentIters(100),
+            freeTranslationStep(0.5f),
+            freeRotationStep(-1e-6),
+            cameraResolution(0.025f),
+            castMode(DepthCamera::GridTraversal),
+            sparseMap(false),
+            fusionThreads(1),
+            pyramidLevels(0),
+            coarseIters(3),
+            interpolatedSampling(false),
+            cachedGradients(false),
+            checkpointInterval(100),
+            incrementalError(true),
+            errorCheckInterval(0),
+            asyncMapping(false),
+            mappingQueueSize(8),
+            mappingBlocks(false)
+    {
+
+    }
+
+    ExperimentRunner::ExperimentRunner() :
+            iter(0),
+            numErrorMismatches(0),
+            mappingLag(0),
+            maxMappingLag(0),
+            sumMappingLag(0),
+            numMappingSteps(0)
+    {
+
+    }
+
+    ExperimentRunner::~ExperimentRunner()
+    {
+
+    }
+
+    void ExperimentRunner::Initialize(const Params& params_)
+    {
+        // The mapping thread must let go of tsdf before it is reset.
+        mapper.Stop();
+        mapSnapshot.reset();
+        mappingLag = 0;
+        maxMappingLag = 0;
+        sumMappingLag = 0;
+        numMappingSteps = 0;
+        params = params_;
+        float linkLengths[] = {50.0f, 40.0f, 25.0f, 0.0f};
+        robot.color = ofColor(200, 10, 10);
+        fakeRobot.color = ofColor(255, 255, 255, 100);
+        odomRobot.color = ofColor(100, 200, 100, 100);
+        robot.Initialize(linkLengths);
+        fakeRobot.Initialize(linkLengths);
+        odomRobot.Initialize(linkLengths);
+        Config config = robot.GetQ();
+        robot.SetQ(config);
+        fakeRobot.SetQ(config);
+        odomRobot.SetQ(config);
+        robot.SetBase(ofVec2f(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2));
+        fakeRobot.SetBase(robot.GetBase());
+        odomRobot.SetBase(robot.GetBase());
+        robot.camera->resolution = params.cameraResolution;
+        fakeRobot.camera->resolution = params.cameraResolution;
+        odomRobot.camera->resolution = params.cameraResolution;
+        freeCamera.resolution = params.cameraResolution;
+        robot.camera->castMode = params.castMode;
+        fakeRobot.camera->castMode = params.castMode;
+        odomRobot.camera->castMode = params.castMode;
+        freeCamera.castMode = params.castMode;
+        if (params.sparseMap)
+        {
+            sparseTsdf.Initialize(world, params.truncation);
+        }
+        else
+        {
+            tsdf.Initialize(world, params.truncation);
+            tsdf.fusionThreads = params.fusionThreads;
+            tsdf.interpolatedSampling = params.interpolatedSampling;
+            tsdf.cachedGradients = params.cachedGradients;
+            tsdfPyramid.Initialize(tsdf, params.pyramidLevels);
+            if (params.asyncMapping)
+            {
+                mapper.Start(tsdf, params.mappingQueueSize, params.mappingBlocks);
+                mapSnapshot = mapper.GetSnapshot();
+            }
+        }
+        particleFilter.numParticles = params.particles;
+        particleFilter.motionNoise = params.particleMotionNoise;
+        particleFilter.minMotionNoise = params.particleMinMotionNoise;
+        particleFilter.initialSpread = 0.0f;
+        particleFilter.sigma = params.particleSigma;
+        particleFilter.numThreads = params.particleThreads;
+        particleFilter.initialized = false;
+        sensors.Reset(SENSOR_FRAMES, robot.camera->GetNumBeams());
+        zeroCalibration = GetJointNoise(robot.GetQ());
+        offset = Config();
+        iter = 0;
+        experimentData.clear();
+        numErrorMismatches = 0;
+
+        if (params.checkpointFile.empty())
+        {
+            checkpointer.Stop();
+        }
+        else
+        {
+            checkpointer.Start(params.checkpointFile);
+        }
+    }
+
+    bool ExperimentRunner::LoadTrajectory(const std::string& file)
+    {
+        return LoadTrajectory(file, trajectory);
+    }
+
+    bool ExperimentRunner::LoadTrajectory(const std::string& file, std::vector<Config>& configs)
+    {
+        TrajectoryReader reader;
+        if (!reader.Open(file) || reader.GetNumColumns() != DOF)
+        {
+            return false;
+        }
+
+        configs.reserve(configs.size() + reader.GetNumRows());
+        for (uint64_t r = 0; r < reader.GetNumRows(); r++)
+        {
+            Config config;
+            reader.GetRow(r, config.m);
+            configs.push_back(config);
+        }
+        return true;
+    }
+
+    ExperimentRunner::Config ExperimentRunner::GetJointNoise(const Config& curr)
+    {
+        Config perturbation;
+        perturbation[0] = params.jointNoiseScale * (ofNoise((float)curr(0), (float)curr(1), (float)curr(2) + 0.5f) - 0.5f);
+        perturbation[1] = params.jointNoiseScale * (ofNoise((float)curr(0), (float)curr(1) + 0.5f, (float)curr(2)) - 0.5f);
+        perturbation[2] = params.jointNoiseScale * (ofNoise((float)curr(0) + 0.5f, (float)curr(1), (float)curr(2)) - 0.5f);
+        return perturbation;
+    }
+
+    bool ExperimentRunner::Step()
+    {
+        if (iter >= trajectory.size())
+        {
+            return false;
+        }
+
+        Step(trajectory[iter]);
+        AppendExperimentDatum();
+        return true;
+    }
+
+    size_t ExperimentRunner::Run()
+    {
+        while (Step())
+        {
+
+        }
+        return iter;
+    }
+
+    void ExperimentRunner::Step(const Config& q)
+    {
+        ARM_SLAM_PROFILE_SCOPE("step");
+        ofVec2f odomEE = odomRobot.GetEEPos();
+        float odomRotation = odomRobot.camera->globalRotation;
+
+        robot.SetQ(q);
+        Config curr = robot.GetQ();
+        {
+            ARM_SLAM_PROFILE_SCOPE("raycast");
+            robot.Update(world);
+            robot.camera->ComputeGradients(world, false);
+        }
+        Config perturbation = GetJointNoise(curr) + zeroCalibration * -1.0f;
+        switch (params.mode)
+        {
+            case GroundTruth:
+            {
+                fakeRobot.SetQ(robot.GetQ());
+                Config odom = robot.GetQ() + perturbation;
+                odomRobot.SetQ(odom);
+                break;
+            }
+            case Odometry:
+            case UnconstraintedDescent:
+            case ConstrainedDescent:
+            case ConstrainedGaussNewton:
+            case ParticleTracking:
+            {
+                Config fake = robot.GetQ() + offset + perturbation;
+                fakeRobot.SetQ(fake);
+                Config odom = robot.GetQ() + perturbation;
+                odomRobot.SetQ(odom);
+                break;
+            }
+        }
+        iter++;
+
+        // Tracking only sees the scan, normals and odometry the simulated
+        // robot hands over, as a driver would.
+        SensorRingBuffer<DOF>::Frame* frame = sensors.BeginWrite();
+        if (frame && frame->SetScan(robot.camera->points, robot.camera->noisyPoints, robot.camera->gradients))
+        {
+            frame->timestamp = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            frame->joints = odomRobot.GetQ();
+            sensors.EndWrite();
+        }
+
+        // The tracked and odometry robots only need their poses; their scans
+        // are replaced by the true robot's below.
+        fakeRobot.UpdateKinematics();
+        odomRobot.UpdateKinematics();
+
+        if (params.sparseMap)
+        {
+            TrackAndFuse(sparseTsdf, odomEE, odomRotation);
+        }
+        else
+        {
+            if (mapper.IsRunning())
+            {
+                mappingLag = mapper.GetLag();
+                mapSnapshot = mapper.GetSnapshot();
+                maxMappingLag = std::max(maxMappingLag, mappingLag);
+                sumMappingLag += mappingLag;
+                numMappingSteps++;
+            }
+            TrackAndFuse(GetTrackingMap(), odomEE, odomRotation);
+        }
+
+        if (checkpointer.IsRunning() && params.checkpointInterval > 0 && iter % params.checkpointInterval == 0)
+        {
+            ARM_SLAM_PROFILE_SCOPE("checkpoint");
+            if (params.sparseMap)
+            {
+                checkpointer.Request(sparseTsdf);
+            }
+            else
+            {
+                checkpointer.Request(GetTrackingMap());
+            }
+        }
+    }
+
+    template <typename T> void ExperimentRunner::TrackAndFuse(T& map, const ofVec2f& odomEE, float odomRotation)
+    {
+        ofVec2f odomEEAfter = odomRobot.GetEEPos();
+        float odomRotationAfter = odomRobot.camera->globalRotation;
+        const SensorRingBuffer<DOF>::Frame* frame = sensors.BeginRead();
+        if (!frame)
+        {
+            return;
+        }
+        const Config& odom = frame->joints;
+
+        {
+            ARM_SLAM_PROFILE_SCOPE("gradients");
+            frame->GetScan(fakeRobot.camera->points, fakeRobot.camera->noisyPoints, normals);
+            // Gauss-Newton samples the map itself, and coarse to fine
+            // tracking computes its own gradients level by level.
+            if (params.mode != ConstrainedGaussNewton && !IsTrackingCoarse())
+            {
+                fakeRobot.camera->ComputeGradients(map, true);
+            }
+        }
+
+        {
+            ARM_SLAM_PROFILE_SCOPE("tracking");
+            switch (params.mode)
+            {
+                case GroundTruth:
+                {
+                    fakeRobot.SetQ(robot.GetQ());
+                    break;
+                }
+                case Odometry:
+                {
+                    break;
+                }
+                case ConstrainedDescent:
+                {
+                    TrackCoarse(map);
+                    fakeRobot.GradientDescent(params.descentIters, params.descentRate, map);
+                    break;
+                }
+                case ConstrainedGaussNewton:
+                {
+                    TrackCoarse(map);
+                    fakeRobot.GaussNewton(params.gaussNewtonIters, params.gaussNewtonLambda, params.gaussNewtonTolerance, map);
+                    break;
+                }
+                case ParticleTracking:
+                {
+                    if (!particleFilter.initialized)
+                    {
+                        particleFilter.Initialize(fakeRobot.GetQ(), odom);
+                    }
+                    else
+                    {
+                        particleFilter.Predict(odom);
+                    }
+                    particleFilter.Update(fakeRobot, fakeRobot.camera->noisyPoints, map);
+                    fakeRobot.SetQ(particleFilter.GetEstimate());
+                    fakeRobot.UpdateKinematics();
+                    break;
+                }
+                case UnconstraintedDescent:
+                {
+                    freeCamera.localRotation += (odomRotationAfter - odomRotation);
+                    freeCamera.localTranslation += (odomEEAfter - odomEE);
+                    freeCamera.points = fakeRobot.camera->points;
+                    freeCamera.noisyPoints = fakeRobot.camera->noisyPoints;
+                    freeCamera.UpdateRecursive();
+                    TrackCoarse(map);
+                    freeCamera.ComputeGradients(map, true);
+                    freeCamera.FreeGradientDescent(map, params.freeDescentIters, params.freeTranslationStep, params.freeRotationStep);
+                    break;
+                }
+            }
+        }
+
+        offset = fakeRobot.GetQ() + odom * -1.0f;
+
+        {
+            ARM_SLAM_PROFILE_SCOPE("fusion");
+            const DepthCamera& camera = params.mode == UnconstraintedDescent ? freeCamera : *fakeRobot.camera;
+            if (mapper.IsRunning())
+            {
+                scan.origin = camera.globalTranslation;
+                scan.rotation = camera.globalRotation;
+                scan.points = camera.noisyPoints;
+                scan.gradients = normals;
+                mapper.Submit(scan);
+            }
+            else
+            {
+                map.FuseRayCloud(camera.globalTranslation, camera.globalRotation, camera.noisyPoints, normals);
+            }
+        }
+        sensors.EndRead();
+    }
+
+    // Runs the current mode's tracker for coarseIters iterations on each
+    // coarse level of the dense tsdf, coarsest first. For constrained
+    // descent it then leaves the robot camera's gradients computed on map
+    // for the full resolution pass; the unconstrained mode computes its
+    // camera's itself and Gauss-Newton needs none.
+    template <typename T> void ExperimentRunner::TrackCoarse(T& map)
+    {
+        if (!IsTrackingCoarse())
+        {
+            return;
+        }
+
+        tsdfPyramid.Update(GetTrackingMap());
+        for (int l = tsdfPyramid.GetNumLevels(); l > 0; l--)
+        {
+            TSDFPyramid::Level level = tsdfPyramid.GetLevel(l);
+            switch (params.mode)
+            {
+                case ConstrainedDescent:
+                {
+                    fakeRobot.camera->ComputeGradients(level, true);
+                    fakeRobot.GradientDescent(params.coarseIters, params.descentRate, level);
+                    fakeRobot.UpdateKinematics();
+                    break;
+                }
+                case ConstrainedGaussNewton:
+                {
+                    fakeRobot.GaussNewton(params.coarseIters, params.gaussNewtonLambda, params.gaussNewtonTolerance, level);
+                    break;
+                }
+                case UnconstraintedDescent:
+                {
+                    freeCamera.ComputeGradients(level, true);
+                    freeCamera.FreeGradientDescent(level, params.coarseIters, params.freeTranslationStep, params.freeRotationStep);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        if (params.mode == ConstrainedDescent)
+        {
+            fakeRobot.camera->ComputeGradients(map, true);
+        }
+    }
+
+    void ExperimentRunner::AppendExperimentDatum()
+    {
+        ARM_SLAM_PROFILE_SCOPE("error");
+        ExperimentDatum datum;
+        datum.odomConfig = odomRobot.GetQ();
+        datum.trackConfig = fakeRobot.GetQ();
+        datum.robotConfig = robot.GetQ();
+
+        ofVec2f truePos = robot.GetEEPos();
+        ofVec2f trackPos = fakeRobot.GetEEPos();
+        switch (params.mode)
+        {
+            case GroundTruth:
+            case ConstrainedDescent:
+            case ConstrainedGaussNewton:
+            case ParticleTracking:
+            case Odometry:
+                datum.eePosError = (truePos - trackPos).length();
+                break;
+            case UnconstraintedDescent:
+                datum.eePosError = (truePos - freeCamera.globalTranslation).length();
+                break;
+        }
+
+        if (params.sparseMap)
+        {
+            sparseTsdf.ComputeError(world, datum.classificationError, datum.tsdfError);
+        }
+        else if (params.incrementalError)
+        {
+            TSDF& map = GetTrackingMap();
+            map.UpdateError(world, datum.classificationError, datum.tsdfError);
+            if (params.errorCheckInterval > 0 && experimentData.size() % params.errorCheckInterval == 0)
+            {
+                float classificationError;
+                float tsdfError;
+                map.ComputeError(world, classificationError, tsdfError);
+                // The full scan sums the squared error in float, so that
+                // may differ by rounding; the counts may not.
+                if (classificationError != datum.classificationError || fabs(tsdfError - datum.tsdfError) > 1e-3f * std::max(tsdfError, 1.0f))
+                {
+                    numErrorMismatches++;
+                }
+            }
+        }
+        else
+        {
+            GetTrackingMap().ComputeError(world, datum.classificationError, datum.tsdfError);
+        }
+        experimentData.push_back(datum);
+
+        if (log.IsOpen())
+        {
+            float row[3 + 3 * DOF];
+            GetExperimentRow(datum, row);
+            log.Append(row);
+        }
+    }
+
+    void ExperimentRunner::SetColors(ofImage* img)
+    {
+        if (params.sparseMap)
+        {
+            sparseTsdf.SetColors(img);
+        }
+        else
+        {
+            GetTrackingMap().SetColors(img);
+        }
+    }
+
+    TSDF& ExperimentRunner::GetTrackingMap()
+    {
+        return mapSnapshot ? *mapSnapshot : tsdf;
+    }
+
+    bool ExperimentRunner::SaveExperimentData(const std::string& file)
+    {
+        TrajectoryWriter writer;
+        if (!writer.Open(file, TrajectoryIO::GetFormat(file), GetExperimentColumns(params.asyncMapping), DOF))
+        {
+            return false;
+        }
+
+        float row[3 + 3 * DOF];
+        for (size_t i = 0; i < experimentData.size(); i++)
+        {
+            GetExperimentRow(experimentData.at(i), row);
+            writer.Append(row);
+        }
+        return writer.Close();
+    }
+
+    bool ExperimentRunner::OpenLog(const std::string& file)
+    {
+        return log.Open(file, TrajectoryIO::GetFormat(file), GetExperimentColumns(params.asyncMapping), DOF);
+    }
+
+    bool ExperimentRunner::CloseLog()
+    {
+        return log.Close();
+    }
+
+    bool ExperimentRunner::LoadMap(const std::string& file)
+    {
+        MapSnapshot snapshot;
+        if (!snapshot.Open(file) || snapshot.GetHeader().width != world.width || snapshot.GetHeader().height != world.height)
+        {
+            return false;
+        }
+
+        bool restored;
+        if (params.sparseMap)
+        {
+            restored = snapshot.Restore(sparseTsdf);
+        }
+        else if (!mapper.IsRunning())
+        {
+            restored = snapshot.Restore(tsdf);
+        }
+        else
+        {
+            mapper.Stop();
+            restored = snapshot.Restore(tsdf);
+            mapper.Start(tsdf, params.mappingQueueSize, params.mappingBlocks);
+            mapSnapshot = mapper.GetSnapshot();
+        }
+
+        // A fresh map takes its frame from the first scan, so there is no
+        // offset from it to search for. A loaded one doesn't, so the
+        // particle filter starts spread over the joint offsets, which
+        // reach half of jointNoiseScale either way.
+        if (restored)
+        {
+            particleFilter.initialSpread = 0.5f * params.jointNoiseScale;
+        }
+        return restored;
+    }
+
+    bool ExperimentRunner::SaveMap(const std::string& file)
+    {
+        // Let a background snapshot finish first so the two writers don't
+        // share the temporary file.
+        checkpointer.Wait();
+        mapper.Wait();
+        if (params.sparseMap)
+        {
+            return MapSnapshot::Save(sparseTsdf, file);
+        }
+        return MapSnapshot::Save(tsdf, file);
+    }
+
+    void ExperimentRunner::GetExperimentRow(const ExperimentDatum& datum, float* row)
+    {
+        row[0] = datum.tsdfError;
+        row[1] = datum.classificationError;
+        row[2] = datum.eePosError;
+        for (size_t k = 0; k < DOF; k++)
+        {
+            row[3 + k] = datum.odomConfig(k);
+            row[3 + DOF + k] = datum.trackConfig(k);
+            row[3 + 2 * DOF + k] = datum.robotConfig(k);
+        }
+    }
+
+    std::vector<std::string> ExperimentRunner::GetTrajectoryColumns()
+    {
+        std::vector<std::string> columns;
+        for (size_t k = 0; k < DOF; k++)
+        {
+            std::stringstream name;
+            name << "q" << k;
+            columns.push_back(name.str());
+        }
+        return columns;
+    }
+
+    std::vector<std::string> ExperimentRunner::GetExperimentColumns(bool snapshotErrors)
+    {
+        std::vector<std::string> columns;
+        columns.push_back(snapshotErrors ? "snapshotTsdfError" : "tsdfError");
+        columns.push_back(snapshotErrors ? "snapshotClassificationError" : "classificationError");
+        columns.push_back("eePosError");
+        const char* prefixes[3] = {"odom", "track", "robot"};
+        for (size_t p = 0; p < 3; p++)
+        {
+            for (size_t k = 0; k < DOF; k++)
+            {
+                std::stringstream name;
+                name << prefixes[p] << k;
+                columns.push_back(name.str());
+            }
+        }
+        return columns;
+    }
+
+    bool ExperimentRunner::ParseExperiment(const std::string& name, Experiment& mode)
+    {
+        for (int i = GroundTruth; i <= ParticleTracking; i++)
+        {
+            if (name == GetExperimentName((Experiment)i))
+            {
+                mode = (Experiment)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char* ExperimentRunner::GetExperimentName(Experiment mode)
+    {
+        switch (mode)
+        {
+            case GroundTruth:
+                return "groundtruth";
+            case Odometry:
+                return "odometry";
+            case ConstrainedDescent:
+                return "constrained";
+            case UnconstraintedDescent:
+                return "unconstrained";
+            case ConstrainedGaussNewton:
+                return "gaussnewton";
+            case ParticleTracking:
+                return "particle";
+        }
+        return "unknown";
+    }
+
+}
@@ -0,0 +1,207 @@
+#ifndef EXPERIMENTRUNNER_H_
+#define EXPERIMENTRUNNER_H_
+
+#include <vector>
+#include <string>
+#include "ofMain.h"
+#include "Robot.h"
+#include "World.h"
+#include "TSDF.h"
+#include "SparseTSDF.h"
+#include "TSDFPyramid.h"
+#include "DepthCamera.h"
+#include "ParticleFilter.h"
+#include "TrajectoryIO.h"
+#include "MapSnapshot.h"
+#include "AsyncMapper.h"
+#include "SensorRingBuffer.h"
+
+namespace arm_slam
+{
+    // Runs the tracking/mapping pipeline one trajectory step at a time,
+    // independent of any window or frame rate.
+    class ExperimentRunner
+    {
+        public:
+            static const size_t DOF = 3;
+            typedef Robot<DOF> ArmRobot;
+            typedef ArmRobot::Config Config;
+            // Frames the simulated sensors can get ahead of tracking.
+            static const size_t SENSOR_FRAMES = 4;
+
+            enum Experiment
+            {
+                GroundTruth,
+                Odometry,
+                ConstrainedDescent,
+                UnconstraintedDescent,
+                // Constrained tracking by Levenberg-Marquardt.
+                ConstrainedGaussNewton,
+                // Constrained tracking by a particle filter.
+                ParticleTracking
+            };
+
+            struct ExperimentDatum
+            {
+                    Config robotConfig;
+                    Config odomConfig;
+                    Config trackConfig;
+                    // Under asyncMapping, these two measure the snapshot
+                    // tracked on, which lacks the scans still queued.
+                    float tsdfError;
+                    float classificationError;
+                    float eePosError;
+            };
+
+            struct Params
+            {
+                    Params();
+                    Experiment mode;
+                    float jointNoiseScale;
+                    float truncation;
+                    int descentIters;
+                    float descentRate;
+                    int gaussNewtonIters;
+                    float gaussNewtonLambda;
+                    float gaussNewtonTolerance;
+                    size_t particles;
+                    float particleMotionNoise;
+                    float particleMinMotionNoise;
+                    float particleSigma;
+                    // Threads scoring particles; 0 uses every core.
+                    size_t particleThreads;
+                    int freeDescentIters;
+                    float freeTranslationStep;
+                    float freeRotationStep;
+                    float cameraResolution;
+                    DepthCamera::CastMode castMode;
+                    // Map into sparseTsdf instead of the dense tsdf.
+                    bool sparseMap;
+                    // Threads fusing each scan into the dense tsdf; 0 uses
+                    // every core.
+                    size_t fusionThreads;
+                    // Coarse levels of the dense tsdf the descent and
+                    // Gauss-Newton trackers align on, coarsest first, before
+                    // the full resolution map; 0 tracks on the full
+                    // resolution map only.
+                    int pyramidLevels;
+                    // Tracker iterations on each coarse level.
+                    int coarseIters;
+                    // Track on bilinearly interpolated distances of the dense
+                    // tsdf, optionally with cached gradients; see
+                    // TSDF::SampleDistGradient.
+                    bool interpolatedSampling;
+                    bool cachedGradients;
+                    // Snapshot the map to checkpointFile in the background
+                    // every checkpointInterval steps; empty disables it.
+                    std::string checkpointFile;
+                    int checkpointInterval;
+                    // Keep the dense tsdf's error up to date with
+                    // TSDF::UpdateError instead of a full ComputeError scan
+                    // every step, cross-checking it against the full scan
+                    // every errorCheckInterval steps; 0 never checks.
+                    bool incrementalError;
+                    int errorCheckInterval;
+                    // Fuse into the dense tsdf on an AsyncMapper thread and
+                    // track on its latest snapshot. Scans are dropped while
+                    // it is mappingQueueSize scans behind, or, with
+                    // mappingBlocks, tracking waits for it instead.
+                    bool asyncMapping;
+                    size_t mappingQueueSize;
+                    bool mappingBlocks;
+            };
+
+            ExperimentRunner();
+            virtual ~ExperimentRunner();
+
+            // The world must already be loaded.
+            void Initialize(const Params& params_);
+            // Trajectories and experiment data are read and written through
+            // TrajectoryIO, as text or, for files ending in .bin, binary.
+            bool LoadTrajectory(const std::string& file);
+            static bool LoadTrajectory(const std::string& file, std::vector<Config>& configs);
+            bool SaveExperimentData(const std::string& file);
+            // Streams every datum to file as it is appended, until CloseLog.
+            bool OpenLog(const std::string& file);
+            bool CloseLog();
+            // Replaces the current map with a MapSnapshot of the same type
+            // and size, e.g. to warm start tracking on a map built before.
+            bool LoadMap(const std::string& file);
+            bool SaveMap(const std::string& file);
+
+            // Advances to the next recorded configuration. Returns false once
+            // the trajectory is exhausted.
+            bool Step();
+            void Step(const Config& q);
+            size_t Run();
+
+            Config GetJointNoise(const Config& curr);
+            void AppendExperimentDatum();
+            void SetColors(ofImage* img);
+            // The dense map tracking reads: the current snapshot under
+            // asyncMapping, otherwise tsdf itself.
+            TSDF& GetTrackingMap();
+
+            static bool ParseExperiment(const std::string& name, Experiment& mode);
+            static const char* GetExperimentName(Experiment mode);
+            // Column names of trajectory and experiment data files.
+            static std::vector<std::string> GetTrajectoryColumns();
+            // Under asyncMapping the map errors are named as the
+            // snapshot's.
+            static std::vector<std::string> GetExperimentColumns(bool snapshotErrors = false);
+
+            Params params;
+            ArmRobot robot;
+            ArmRobot fakeRobot;
+            ArmRobot odomRobot;
+            DepthCamera freeCamera;
+            ParticleFilter<DOF> particleFilter;
+            Config offset;
+            Config zeroCalibration;
+            World world;
+            TSDF tsdf;
+            TSDFPyramid tsdfPyramid;
+            SparseTSDF sparseTsdf;
+            size_t iter;
+            std::vector<Config> trajectory;
+            std::vector<ExperimentDatum> experimentData;
+            TrajectoryWriter log;
+            MapCheckpointer checkpointer;
+            // Cross-checks where the incremental error disagreed with the
+            // full scan.
+            size_t numErrorMismatches;
+            // Scans and odometry from the simulated robot to tracking.
+            SensorRingBuffer<DOF> sensors;
+            AsyncMapper mapper;
+            // Snapshot of mapper taken at the start of the last step; holds
+            // its buffer until the next.
+            std::shared_ptr<TSDF> mapSnapshot;
+            // Scans mapSnapshot was at most missing when it was taken, and
+            // the largest and total of that over the steps tracked on a
+            // snapshot.
+            size_t mappingLag;
+            size_t maxMappingLag;
+            size_t sumMappingLag;
+            size_t numMappingSteps;
+
+        protected:
+            static void GetExperimentRow(const ExperimentDatum& datum, float* row);
+
+            template <typename T> void TrackAndFuse(T& map, const ofVec2f& odomEE, float odomRotation);
+            template <typename T> void TrackCoarse(T& map);
+            // Whether the current mode tracks on coarse levels before the
+            // full resolution pass.
+            inline bool IsTrackingCoarse() const
+            {
+                const bool coarseMode = params.mode == ConstrainedDescent || params.mode == ConstrainedGaussNewton || params.mode == UnconstraintedDescent;
+                return coarseMode && !params.sparseMap && tsdfPyramid.GetNumLevels() > 0;
+            }
+
+            AsyncMapper::Scan scan;
+            // Normals of the scan being tracked, as read from sensors.
+            std::vector<ofVec2f> normals;
+    };
+
+}
+
+#endif // EXPERIMENTRUNNER_H_
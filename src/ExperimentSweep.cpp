@@ -0,0 +1,173 @@
+#include "ExperimentSweep.h"
+#include "ThreadPool.h"
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+namespace arm_slam
+{
+
+    ExperimentSweep::ExperimentSweep()
+    {
+        Params defaults;
+        modes.push_back(defaults.mode);
+        jointNoiseScales.push_back(defaults.jointNoiseScale);
+        truncations.push_back(defaults.truncation);
+        descentIters.push_back(defaults.descentIters);
+        descentRates.push_back(defaults.descentRate);
+        freeTranslationSteps.push_back(defaults.freeTranslationStep);
+        freeRotationSteps.push_back(defaults.freeRotationStep);
+        cameraResolutions.push_back(defaults.cameraResolution);
+    }
+
+    ExperimentSweep::~ExperimentSweep()
+    {
+
+    }
+
+    std::vector<ExperimentSweep::Params> ExperimentSweep::Expand() const
+    {
+        std::vector<Params> grid;
+        for (size_t m = 0; m < modes.size(); m++)
+        {
+            for (size_t n = 0; n < jointNoiseScales.size(); n++)
+            {
+                for (size_t t = 0; t < truncations.size(); t++)
+                {
+                    for (size_t i = 0; i < descentIters.size(); i++)
+                    {
+                        for (size_t r = 0; r < descentRates.size(); r++)
+                        {
+                            for (size_t ft = 0; ft < freeTranslationSteps.size(); ft++)
+                            {
+                                for (size_t fr = 0; fr < freeRotationSteps.size(); fr++)
+                                {
+                                    for (size_t c = 0; c < cameraResolutions.size(); c++)
+                                    {
+                                        Params params;
+                                        params.mode = modes[m];
+                                        params.jointNoiseScale = jointNoiseScales[n];
+                                        params.truncation = truncations[t];
+                                        params.descentIters = descentIters[i];
+                                        params.freeDescentIters = descentIters[i];
+                                        params.descentRate = descentRates[r];
+                                        params.freeTranslationStep = freeTranslationSteps[ft];
+                                        params.freeRotationStep = freeRotationSteps[fr];
+                                        params.cameraResolution = cameraResolutions[c];
+                                        grid.push_back(params);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return grid;
+    }
+
+    std::string ExperimentSweep::GetRunName(const Params& params)
+    {
+        std::stringstream ss;
+        ss << ExperimentRunner::GetExperimentName(params.mode)
+           << "_n" << params.jointNoiseScale
+           << "_t" << params.truncation
+           << "_i" << params.descentIters
+           << "_r" << params.descentRate
+           << "_ft" << params.freeTranslationStep
+           << "_fr" << params.freeRotationStep
+           << "_c" << params.cameraResolution;
+        return ss.str();
+    }
+
+    bool ExperimentSweep::Run(const World& world, const std::vector<Config>& trajectory, const std::string& outputDir, size_t numThreads)
+    {
+        std::vector<Params> grid = Expand();
+        results.clear();
+        results.resize(grid.size());
+
+        for (size_t i = 0; i < grid.size(); i++)
+        {
+            results[i].params = grid[i];
+            results[i].file = outputDir + "/" + GetRunName(grid[i]) + ".txt";
+        }
+
+        ThreadPool pool(std::min(numThreads > 0 ? numThreads : ThreadPool::GetHardwareThreads(), std::max<size_t>(grid.size(), 1)));
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            Result* result = &results[i];
+            pool.Enqueue([&world, &trajectory, result] { RunOne(world, trajectory, *result); });
+        }
+        pool.Wait();
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (!results[i].saved)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void ExperimentSweep::RunOne(const World& world, const std::vector<Config>& trajectory, Result& result)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ExperimentRunner runner;
+        runner.world = world;
+        runner.Initialize(result.params);
+        runner.trajectory = trajectory;
+        result.steps = runner.Run();
+        result.saved = runner.SaveExperimentData(result.file);
+
+        result.finalTsdfError = 0.0f;
+        result.finalClassificationError = 0.0f;
+        result.meanEEPosError = 0.0f;
+        result.maxEEPosError = 0.0f;
+
+        if (!runner.experimentData.empty())
+        {
+            const ExperimentRunner::ExperimentDatum& last = runner.experimentData.back();
+            result.finalTsdfError = last.tsdfError;
+            result.finalClassificationError = last.classificationError;
+
+            double sum = 0.0;
+            for (size_t i = 0; i < runner.experimentData.size(); i++)
+            {
+                float err = runner.experimentData[i].eePosError;
+                sum += err;
+                result.maxEEPosError = std::max(result.maxEEPosError, err);
+            }
+            result.meanEEPosError = sum / runner.experimentData.size();
+        }
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool ExperimentSweep::SaveSummary(const std::string& file) const
+    {
+        std::ofstream stream;
+        stream.open(file.c_str(), std::ios::out);
+
+        if (!stream.is_open())
+        {
+            return false;
+        }
+
+        stream << "mode noise truncation iters rate freeTranslationStep freeRotationStep resolution saved steps tsdfError classificationError meanEEError maxEEError seconds file\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            stream << ExperimentRunner::GetExperimentName(r.params.mode) << " " << r.params.jointNoiseScale
+                   << " " << r.params.truncation << " " << r.params.descentIters << " " << r.params.descentRate
+                   << " " << r.params.freeTranslationStep << " " << r.params.freeRotationStep
+                   << " " << r.params.cameraResolution << " " << r.saved << " " << r.steps << " " << r.finalTsdfError
+                   << " " << r.finalClassificationError << " " << r.meanEEPosError << " " << r.maxEEPosError
+                   << " " << r.seconds << " " << r.file << "\n";
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,62 @@
+#ifndef EXPERIMENTSWEEP_H_
+#define EXPERIMENTSWEEP_H_
+
+#include <vector>
+#include <string>
+#include "ExperimentRunner.h"
+#include "World.h"
+
+namespace arm_slam
+{
+    // Runs every combination of a parameter grid as an independent pipeline
+    // on a thread pool. Each run gets its own World/TSDF/Robot instances.
+    class ExperimentSweep
+    {
+        public:
+            typedef ExperimentRunner::Config Config;
+            typedef ExperimentRunner::Params Params;
+
+            struct Result
+            {
+                    Params params;
+                    std::string file;
+                    // False if file could not be written.
+                    bool saved;
+                    size_t steps;
+                    float finalTsdfError;
+                    float finalClassificationError;
+                    float meanEEPosError;
+                    float maxEEPosError;
+                    double seconds;
+            };
+
+            ExperimentSweep();
+            virtual ~ExperimentSweep();
+
+            std::vector<Params> Expand() const;
+
+            // Runs the whole grid against a shared world and trajectory,
+            // writing one experiment file per run into outputDir. Returns
+            // false if any of them could not be written.
+            bool Run(const World& world, const std::vector<Config>& trajectory, const std::string& outputDir, size_t numThreads);
+            bool SaveSummary(const std::string& file) const;
+
+            static std::string GetRunName(const Params& params);
+
+            std::vector<ExperimentRunner::Experiment> modes;
+            std::vector<float> jointNoiseScales;
+            std::vector<float> truncations;
+            std::vector<int> descentIters;
+            std::vector<float> descentRates;
+            std::vector<float> freeTranslationSteps;
+            std::vector<float> freeRotationSteps;
+            std::vector<float> cameraResolutions;
+            std::vector<Result> results;
+
+        protected:
+            static void RunOne(const World& world, const std::vector<Config>& trajectory, Result& result);
+    };
+
+}
+
+#endif // EXPERIMENTSWEEP_H_
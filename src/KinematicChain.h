@@ -0,0 +1,283 @@
+#ifndef KINEMATICCHAIN_H_
+#define KINEMATICCHAIN_H_
+
+#include "ofMain.h"
+#include "ThreadPool.h"
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace arm_slam
+{
+    // Forward kinematics of a planar serial arm of N revolute joints and
+    // N + 1 links, kept in flat arrays. Frame 0 is the base, frame k + 1 the
+    // end of link k, so joint k sits at frame k and turns everything after
+    // it by q[k], and the camera sits at frame N + 1. Update computes every
+    // frame in one pass from the base outwards, with the same arithmetic as
+    // Node::UpdateRecursive on the equivalent Joint/Link tree.
+    template <size_t N> class KinematicChain
+    {
+        public:
+            static const size_t NUM_FRAMES = N + 2;
+            // Configurations evaluated side by side by ComputeBatch, one per
+            // lane of an AVX register.
+            static const size_t BATCH_WIDTH = 8;
+
+            struct Pose
+            {
+                ofVec2f translation;
+                float rotation;
+            };
+
+            KinematicChain() :
+                base(0, 0),
+                baseRotation(0.0f)
+            {
+                for(size_t i = 0; i < N; i++)
+                {
+                    q[i] = 0.0f;
+                }
+
+                for(size_t i = 0; i < N + 1; i++)
+                {
+                    lengths[i] = 0.0f;
+                }
+
+                for(size_t i = 0; i < NUM_FRAMES; i++)
+                {
+                    translations[i] = ofVec2f(0, 0);
+                    rotations[i] = 0.0f;
+                }
+            }
+
+            ~KinematicChain()
+            {
+
+            }
+
+            void SetLengths(const float* lengths_)
+            {
+                for(size_t i = 0; i < N + 1; i++)
+                {
+                    lengths[i] = lengths_[i];
+                }
+            }
+
+            void SetBase(const ofVec2f& translation, float rotation)
+            {
+                base = translation;
+                baseRotation = rotation;
+            }
+
+            void Update()
+            {
+                float rotation = baseRotation;
+                ofVec2f translation = base;
+                translations[0] = translation;
+                rotations[0] = rotation;
+                for(size_t i = 0; i < N + 1; i++)
+                {
+                    if(i < N)
+                    {
+                        rotation += q[i];
+                    }
+
+                    translation += ofVec2f(lengths[i], 0).getRotatedRad(-rotation);
+                    translations[i + 1] = translation;
+                    rotations[i + 1] = rotation;
+                }
+            }
+
+            // Camera pose of each of the n configurations, where qs[j][k] is
+            // the angle of joint k in configuration j, from the lengths and
+            // base of this chain, which is left untouched. Configurations
+            // are transposed into blocks of BATCH_WIDTH lanes, so every step
+            // along the chain is one vector operation for the whole block,
+            // and blocks are split across numThreads. Sines and cosines come
+            // from SinCos, so poses can differ from Update in the last bits.
+            template <typename C> void ComputeBatch(const C* qs, size_t n, Pose* out, size_t numThreads = 1) const
+            {
+                const size_t numBlocks = (n + BATCH_WIDTH - 1) / BATCH_WIDTH;
+                ParallelFor(0, numBlocks, numThreads, [this, qs, n, out](size_t begin, size_t end)
+                {
+                    for(size_t b = begin; b < end; b++)
+                    {
+                        ComputeBlock(qs, n, b * BATCH_WIDTH, out);
+                    }
+                });
+            }
+
+            // Sine and cosine of a. Reduces a by multiples of pi / 2 in three
+            // parts and evaluates the minimax polynomials of Cephes' sinf and
+            // cosf, which agree with libm to about one ulp for |a| < 8000.
+            static inline void SinCos(float a, float& s, float& c)
+            {
+                const float j = floorf(a * 0.63661977236f + 0.5f);
+                const int quadrant = (int)j;
+                const float r = ((a - j * 1.5703125f) - j * 4.837512969970703125e-4f) - j * 7.54978995489188216e-8f;
+                const float r2 = r * r;
+                const float sinR = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+                const float cosR = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+                const bool swap = (quadrant & 1) != 0;
+                const float sinQ = swap ? cosR : sinR;
+                const float cosQ = swap ? sinR : cosR;
+                s = (quadrant & 2) != 0 ? -sinQ : sinQ;
+                c = ((quadrant + 1) & 2) != 0 ? -cosQ : cosQ;
+            }
+
+#ifdef __AVX__
+            // SinCos of eight angles. The quadrant stays in float since AVX
+            // has no 256 bit integer operations.
+            static inline void SinCos(__m256 a, __m256& s, __m256& c)
+            {
+                const __m256 j = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(0.63661977236f)), _mm256_set1_ps(0.5f)));
+                __m256 r = _mm256_sub_ps(a, _mm256_mul_ps(j, _mm256_set1_ps(1.5703125f)));
+                r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(4.837512969970703125e-4f)));
+                r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(7.54978995489188216e-8f)));
+                const __m256 r2 = _mm256_mul_ps(r, r);
+
+                __m256 sinR = _mm256_add_ps(_mm256_set1_ps(8.3321608736e-3f), _mm256_mul_ps(r2, _mm256_set1_ps(-1.9515295891e-4f)));
+                sinR = _mm256_add_ps(_mm256_set1_ps(-1.6666654611e-1f), _mm256_mul_ps(r2, sinR));
+                sinR = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), sinR));
+
+                __m256 cosR = _mm256_add_ps(_mm256_set1_ps(-1.388731625493765e-3f), _mm256_mul_ps(r2, _mm256_set1_ps(2.443315711809948e-5f)));
+                cosR = _mm256_add_ps(_mm256_set1_ps(4.166664568298827e-2f), _mm256_mul_ps(r2, cosR));
+                cosR = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)), _mm256_mul_ps(_mm256_mul_ps(r2, r2), cosR));
+
+                // j mod 4, then its low bit.
+                const __m256 quadrant = _mm256_sub_ps(j, _mm256_mul_ps(_mm256_set1_ps(4.0f), _mm256_floor_ps(_mm256_mul_ps(j, _mm256_set1_ps(0.25f)))));
+                const __m256 odd = _mm256_sub_ps(quadrant, _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_floor_ps(_mm256_mul_ps(quadrant, _mm256_set1_ps(0.5f)))));
+                const __m256 swap = _mm256_cmp_ps(odd, _mm256_set1_ps(0.5f), _CMP_GT_OQ);
+                const __m256 negateSin = _mm256_cmp_ps(quadrant, _mm256_set1_ps(1.5f), _CMP_GT_OQ);
+                const __m256 negateCos = _mm256_and_ps(_mm256_cmp_ps(quadrant, _mm256_set1_ps(0.5f), _CMP_GT_OQ), _mm256_cmp_ps(quadrant, _mm256_set1_ps(2.5f), _CMP_LT_OQ));
+                const __m256 sign = _mm256_set1_ps(-0.0f);
+                s = _mm256_xor_ps(_mm256_blendv_ps(sinR, cosR, swap), _mm256_and_ps(negateSin, sign));
+                c = _mm256_xor_ps(_mm256_blendv_ps(cosR, sinR, swap), _mm256_and_ps(negateCos, sign));
+            }
+#endif
+
+            inline const ofVec2f& GetJointTranslation(size_t k) const
+            {
+                return translations[k];
+            }
+
+            inline float GetJointRotation(size_t k) const
+            {
+                return rotations[k + 1];
+            }
+
+            inline const ofVec2f& GetLinkTranslation(size_t k) const
+            {
+                return translations[k + 1];
+            }
+
+            inline float GetLinkRotation(size_t k) const
+            {
+                return rotations[k + 1];
+            }
+
+            inline const ofVec2f& GetCameraTranslation() const
+            {
+                return translations[N + 1];
+            }
+
+            inline float GetCameraRotation() const
+            {
+                return rotations[N + 1];
+            }
+
+            float q[N];
+            float lengths[N + 1];
+            ofVec2f base;
+            float baseRotation;
+            ofVec2f translations[NUM_FRAMES];
+            float rotations[NUM_FRAMES];
+
+        protected:
+            template <typename C> void ComputeBlock(const C* qs, size_t n, size_t first, Pose* out) const
+            {
+                const size_t count = std::min(BATCH_WIDTH, n - first);
+                float angles[N][BATCH_WIDTH];
+                for(size_t l = 0; l < BATCH_WIDTH; l++)
+                {
+                    for(size_t k = 0; k < N; k++)
+                    {
+                        angles[k][l] = l < count ? qs[first + l][k] : 0.0f;
+                    }
+                }
+
+                float x[BATCH_WIDTH];
+                float y[BATCH_WIDTH];
+                float rotation[BATCH_WIDTH];
+#ifdef __AVX__
+                __m256 xV = _mm256_set1_ps(base.x);
+                __m256 yV = _mm256_set1_ps(base.y);
+                __m256 rotationV = _mm256_set1_ps(baseRotation);
+                const __m256 sign = _mm256_set1_ps(-0.0f);
+                for(size_t i = 0; i < N + 1; i++)
+                {
+                    if(i < N)
+                    {
+                        rotationV = _mm256_add_ps(rotationV, _mm256_loadu_ps(angles[i]));
+                    }
+
+                    if(lengths[i] == 0.0f)
+                    {
+                        continue;
+                    }
+
+                    __m256 s;
+                    __m256 c;
+                    SinCos(_mm256_xor_ps(rotationV, sign), s, c);
+                    const __m256 length = _mm256_set1_ps(lengths[i]);
+                    xV = _mm256_add_ps(xV, _mm256_mul_ps(length, c));
+                    yV = _mm256_add_ps(yV, _mm256_mul_ps(length, s));
+                }
+                _mm256_storeu_ps(x, xV);
+                _mm256_storeu_ps(y, yV);
+                _mm256_storeu_ps(rotation, rotationV);
+#else
+                for(size_t l = 0; l < BATCH_WIDTH; l++)
+                {
+                    x[l] = base.x;
+                    y[l] = base.y;
+                    rotation[l] = baseRotation;
+                }
+
+                for(size_t i = 0; i < N + 1; i++)
+                {
+                    if(i < N)
+                    {
+                        for(size_t l = 0; l < BATCH_WIDTH; l++)
+                        {
+                            rotation[l] += angles[i][l];
+                        }
+                    }
+
+                    if(lengths[i] == 0.0f)
+                    {
+                        continue;
+                    }
+
+                    const float length = lengths[i];
+                    for(size_t l = 0; l < BATCH_WIDTH; l++)
+                    {
+                        float s;
+                        float c;
+                        SinCos(-rotation[l], s, c);
+                        x[l] += length * c;
+                        y[l] += length * s;
+                    }
+                }
+#endif
+
+                for(size_t l = 0; l < count; l++)
+                {
+                    out[first + l].translation = ofVec2f(x[l], y[l]);
+                    out[first + l].rotation = rotation[l];
+                }
+            }
+    };
+}
+
+#endif // KINEMATICCHAIN_H_
@@ -0,0 +1,317 @@
+#include "MapSnapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace arm_slam
+{
+    static const char MAGIC[4] = {'A', 'S', 'M', 'S'};
+
+    // Flushes the directory entry of file, so a rename into it survives a
+    // power loss.
+    static bool SyncDirectory(const std::string& file)
+    {
+        const size_t slash = file.find_last_of('/');
+        const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : file.substr(0, slash);
+        const int fd = open(dir.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        const bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+
+    MapSnapshot::MapSnapshot() :
+            header(NULL),
+            mapped(NULL),
+            mappedSize(0)
+    {
+
+    }
+
+    MapSnapshot::~MapSnapshot()
+    {
+        Close();
+    }
+
+    bool MapSnapshot::Save(const TSDF& map, const std::string& file)
+    {
+        return Save(Dense, map.width, map.height, map.truncation, map.cells.empty() ? NULL : &map.cells[0], map.cells.size(), file);
+    }
+
+    bool MapSnapshot::Save(const SparseTSDF& map, const std::string& file)
+    {
+        return Save(Sparse, map.width, map.height, map.truncation, map.blocks.empty() ? NULL : &map.blocks[0], map.blocks.size(), file);
+    }
+
+    bool MapSnapshot::Save(Type type, int width, int height, float truncation, const void* data, uint64_t numElements, const std::string& file)
+    {
+        Header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.type = type;
+        h.elementSize = type == Dense ? sizeof(TSDF::Cell) : sizeof(SparseTSDF::Block);
+        h.width = width;
+        h.height = height;
+        h.truncation = truncation;
+        h.numElements = numElements;
+
+        const std::string tmp = file + ".tmp";
+        FILE* stream = fopen(tmp.c_str(), "wb");
+        if (!stream)
+        {
+            return false;
+        }
+        bool ok = fwrite(&h, sizeof(h), 1, stream) == 1;
+        if (ok && numElements > 0)
+        {
+            ok = fwrite(data, h.elementSize, numElements, stream) == numElements;
+        }
+        // The data must be on disk before the rename is, or a power loss
+        // could leave file renamed but empty.
+        ok = ok && fflush(stream) == 0 && fsync(fileno(stream)) == 0;
+        ok = fclose(stream) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), file.c_str()) != 0)
+        {
+            remove(tmp.c_str());
+            return false;
+        }
+        return SyncDirectory(file);
+    }
+
+    bool MapSnapshot::Open(const std::string& file)
+    {
+        Close();
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+        {
+            close(fd);
+            return false;
+        }
+        mappedSize = (size_t)info.st_size;
+        mapped = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            mapped = NULL;
+            return false;
+        }
+
+        const Header* h = (const Header*)mapped;
+        const uint32_t elementSize = h->type == Dense ? sizeof(TSDF::Cell) : sizeof(SparseTSDF::Block);
+        const bool valid = memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0
+                && h->version == VERSION
+                && (h->type == Dense || h->type == Sparse)
+                && h->elementSize == elementSize
+                && h->width > 0 && h->height > 0
+                && (h->type != Dense || h->numElements == (uint64_t)h->width * h->height)
+                && h->numElements <= (mappedSize - sizeof(Header)) / elementSize;
+        if (!valid)
+        {
+            Close();
+            return false;
+        }
+        header = h;
+        return true;
+    }
+
+    void MapSnapshot::Close()
+    {
+        if (mapped)
+        {
+            munmap(mapped, mappedSize);
+        }
+        header = NULL;
+        mapped = NULL;
+        mappedSize = 0;
+    }
+
+    bool MapSnapshot::Restore(TSDF& map) const
+    {
+        if (!header || header->type != Dense)
+        {
+            return false;
+        }
+        map.Initialize(header->width, header->height, header->truncation);
+        memcpy(&map.cells[0], GetCells(), header->numElements * sizeof(TSDF::Cell));
+        return true;
+    }
+
+    bool MapSnapshot::Restore(SparseTSDF& map) const
+    {
+        if (!header || header->type != Sparse)
+        {
+            return false;
+        }
+        map.Initialize(header->width, header->height, header->truncation);
+        map.blocks.assign(GetBlocks(), GetBlocks() + header->numElements);
+        map.RebuildIndex();
+        return true;
+    }
+
+    MapCheckpointer::MapCheckpointer() :
+            numWritten(0),
+            numDropped(0),
+            ok(true),
+            busy(false),
+            stopping(false),
+            type(MapSnapshot::Dense),
+            lastVersion(0)
+    {
+
+    }
+
+    MapCheckpointer::~MapCheckpointer()
+    {
+        Stop();
+    }
+
+    void MapCheckpointer::Start(const std::string& file_)
+    {
+        Stop();
+        file = file_;
+        numWritten = 0;
+        numDropped = 0;
+        ok = true;
+        busy = false;
+        stopping = false;
+        lastVersion = 0;
+        denseStaging.cells.clear();
+        worker = std::thread(&MapCheckpointer::WorkerLoop, this);
+    }
+
+    void MapCheckpointer::Stop()
+    {
+        if (!worker.joinable())
+        {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+
+    bool MapCheckpointer::BeginRequest()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!worker.joinable() || busy)
+        {
+            numDropped++;
+            return false;
+        }
+        return true;
+    }
+
+    bool MapCheckpointer::Request(TSDF& map)
+    {
+        if (!BeginRequest())
+        {
+            return false;
+        }
+
+        // The worker only reads the staging map while busy, so it can be
+        // updated here without holding the lock.
+        if (denseStaging.width != map.width || denseStaging.height != map.height || denseStaging.cells.size() != map.cells.size())
+        {
+            denseStaging.Initialize(map.width, map.height, map.truncation);
+            lastVersion = 0;
+        }
+        denseStaging.truncation = map.truncation;
+
+        const uint32_t upTo = map.Checkpoint();
+        for (int ty = 0; ty < map.tilesHigh; ty++)
+        {
+            for (int tx = 0; tx < map.tilesWide; tx++)
+            {
+                if (!map.IsTileChanged(tx + ty * map.tilesWide, lastVersion, upTo))
+                {
+                    continue;
+                }
+
+                const int x0 = tx << TSDF::TILE_SHIFT;
+                const int x1 = std::min(x0 + TSDF::TILE_SIZE, map.width);
+                const int y1 = std::min((ty + 1) << TSDF::TILE_SHIFT, map.height);
+                for (int y = ty << TSDF::TILE_SHIFT; y < y1; y++)
+                {
+                    const int idx = map.GetIdx(x0, y);
+                    memcpy(&denseStaging.cells[idx], &map.cells[idx], (x1 - x0) * sizeof(TSDF::Cell));
+                }
+            }
+        }
+        lastVersion = upTo;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            type = MapSnapshot::Dense;
+            busy = true;
+        }
+        changed.notify_all();
+        return true;
+    }
+
+    bool MapCheckpointer::Request(const SparseTSDF& map)
+    {
+        if (!BeginRequest())
+        {
+            return false;
+        }
+
+        sparseStaging.width = map.width;
+        sparseStaging.height = map.height;
+        sparseStaging.truncation = map.truncation;
+        sparseStaging.blocks = map.blocks;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            type = MapSnapshot::Sparse;
+            busy = true;
+        }
+        changed.notify_all();
+        return true;
+    }
+
+    void MapCheckpointer::Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !busy; });
+    }
+
+    void MapCheckpointer::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [this] { return busy || stopping; });
+            if (!busy)
+            {
+                return;
+            }
+
+            lock.unlock();
+            const bool written = type == MapSnapshot::Dense ? MapSnapshot::Save(denseStaging, file) : MapSnapshot::Save(sparseStaging, file);
+            lock.lock();
+
+            ok = ok && written;
+            numWritten += written ? 1 : 0;
+            busy = false;
+            changed.notify_all();
+        }
+    }
+
+}
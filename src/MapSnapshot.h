@@ -0,0 +1,150 @@
+#ifndef MAPSNAPSHOT_H_
+#define MAPSNAPSHOT_H_
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include "TSDF.h"
+#include "SparseTSDF.h"
+
+namespace arm_slam
+{
+    // A TSDF saved as a Header followed by the map's own memory: the cells
+    // of a dense TSDF or the blocks of a SparseTSDF, exactly as they sit in
+    // their vectors. Open maps the file and checks the header, and Restore
+    // is a single copy out of the mapping, so there is nothing to parse.
+    // Snapshots are native endian and only read back by the build that
+    // wrote them, which the header's cell and block sizes check.
+    class MapSnapshot
+    {
+        public:
+            enum Type
+            {
+                Dense,
+                Sparse
+            };
+
+            // 64 bytes, so the map data that follows is cache line aligned
+            // in the mapping.
+            struct Header
+            {
+                    char magic[4];
+                    uint32_t version;
+                    uint32_t type;
+                    // sizeof(TSDF::Cell) or sizeof(SparseTSDF::Block).
+                    uint32_t elementSize;
+                    int32_t width;
+                    int32_t height;
+                    float truncation;
+                    uint32_t reserved0;
+                    // Cells or blocks.
+                    uint64_t numElements;
+                    uint64_t reserved[3];
+            };
+
+            static const uint32_t VERSION = 1;
+
+            MapSnapshot();
+            virtual ~MapSnapshot();
+
+            // Writes to file + ".tmp", syncs it to disk and renames it over
+            // file, so file always holds a whole snapshot, even after a
+            // crash or power loss. Returns false if any step fails; file is
+            // then left as it was, unless only syncing the rename failed.
+            static bool Save(const TSDF& map, const std::string& file);
+            static bool Save(const SparseTSDF& map, const std::string& file);
+            static bool Save(Type type, int width, int height, float truncation, const void* data, uint64_t numElements, const std::string& file);
+
+            bool Open(const std::string& file);
+            void Close();
+
+            inline bool IsOpen() const
+            {
+                return header != NULL;
+            }
+
+            inline const Header& GetHeader() const
+            {
+                return *header;
+            }
+
+            // The cells of a dense snapshot, in place in the mapping.
+            inline const TSDF::Cell* GetCells() const
+            {
+                return header->type == Dense ? (const TSDF::Cell*)(header + 1) : NULL;
+            }
+
+            // The blocks of a sparse snapshot, in place in the mapping.
+            inline const SparseTSDF::Block* GetBlocks() const
+            {
+                return header->type == Sparse ? (const SparseTSDF::Block*)(header + 1) : NULL;
+            }
+
+            // Replaces map with the snapshot. Fails if the snapshot is of
+            // the other map type. Every tile of a dense map counts as
+            // changed afterwards.
+            bool Restore(TSDF& map) const;
+            bool Restore(SparseTSDF& map) const;
+
+        protected:
+            const Header* header;
+            void* mapped;
+            size_t mappedSize;
+    };
+
+    // Saves snapshots of a map on a background thread. Request copies what
+    // changed since the last copy into a staging map on the calling thread,
+    // which is all the caller waits for, and the thread writes the staging
+    // map out. A dense map only copies the tiles stamped since the last
+    // copy. A request made while the previous snapshot is still being
+    // written is dropped, leaving its changes for the next one.
+    class MapCheckpointer
+    {
+        public:
+            MapCheckpointer();
+            virtual ~MapCheckpointer();
+
+            void Start(const std::string& file_);
+            // Waits for the snapshot being written, then stops the thread.
+            void Stop();
+
+            inline bool IsRunning() const
+            {
+                return worker.joinable();
+            }
+
+            // Returns false if the request was dropped.
+            bool Request(TSDF& map);
+            bool Request(const SparseTSDF& map);
+
+            // Blocks until no snapshot is being written.
+            void Wait();
+
+            // Snapshots written and requests dropped since Start.
+            size_t numWritten;
+            size_t numDropped;
+            // False once a write has failed.
+            bool ok;
+
+        protected:
+            bool BeginRequest();
+            void WorkerLoop();
+
+            std::string file;
+            std::thread worker;
+            std::mutex mutex;
+            std::condition_variable changed;
+            bool busy;
+            bool stopping;
+            MapSnapshot::Type type;
+            TSDF denseStaging;
+            // Version of the dense map at the last copy.
+            uint32_t lastVersion;
+            SparseTSDF sparseStaging;
+    };
+}
+
+#endif // MAPSNAPSHOT_H_
@@ -0,0 +1,199 @@
+#ifndef OCCUPANCYGRID_H_
+#define OCCUPANCYGRID_H_
+
+#include <vector>
+#include <stdint.h>
+#include <algorithm>
+
+namespace arm_slam
+{
+    // Bit-packed collision grid. Every 8x8 tile of cells is one 64 bit word,
+    // so whole tiles can be tested at once. The grid is padded by one tile
+    // of occupied cells on every side: any cell within PADDING of the map
+    // can be read without a bounds check, and a unit-step walk that leaves
+    // the map always stops on an occupied padding cell first.
+    class OccupancyGrid
+    {
+        public:
+            enum Layout
+            {
+                // Tiles in row-major order.
+                RowMajor,
+                // Tiles grouped into 8x8 blocks (64x64 cells), Morton order
+                // inside each block, blocks in row-major order.
+                MortonTiled
+            };
+
+            static const int TILE_SHIFT = 3;
+            static const int TILE_SIZE = 1 << TILE_SHIFT;
+            static const int TILE_MASK = TILE_SIZE - 1;
+            static const int PADDING = TILE_SIZE;
+
+            OccupancyGrid() :
+                width(0),
+                height(0),
+                tilesWide(0),
+                tilesHigh(0),
+                groupsWide(0),
+                layout(RowMajor)
+            {
+
+            }
+
+            virtual ~OccupancyGrid()
+            {
+
+            }
+
+            // Every cell, including the padding, starts out occupied.
+            void Initialize(int w, int h, Layout layout_)
+            {
+                width = w;
+                height = h;
+                layout = layout_;
+                tilesWide = ((width + 2 * PADDING) + TILE_MASK) >> TILE_SHIFT;
+                tilesHigh = ((height + 2 * PADDING) + TILE_MASK) >> TILE_SHIFT;
+                groupsWide = (tilesWide + TILE_MASK) >> TILE_SHIFT;
+                const int groupsHigh = (tilesHigh + TILE_MASK) >> TILE_SHIFT;
+                const size_t numTiles = layout == RowMajor ? tilesWide * tilesHigh : groupsWide * groupsHigh * TILE_SIZE * TILE_SIZE;
+                tiles.assign(numTiles, ~(uint64_t)0);
+                clearance.assign(tilesWide * tilesHigh, 0);
+            }
+
+            inline bool IsValid(int x, int y) const
+            {
+                return x >= 0 && x < width && y >= 0 && y < height;
+            }
+
+            // True if (x, y) can be read with Get.
+            inline bool IsInPadding(int x, int y) const
+            {
+                return (unsigned)(x + PADDING) < (unsigned)(width + 2 * PADDING)
+                        && (unsigned)(y + PADDING) < (unsigned)(height + 2 * PADDING);
+            }
+
+            // (x, y) must be within PADDING of the map. Cells outside the map
+            // read as occupied.
+            inline bool Get(int x, int y) const
+            {
+                const int px = x + PADDING;
+                const int py = y + PADDING;
+                return (tiles[GetTileIdx(px >> TILE_SHIFT, py >> TILE_SHIFT)] >> GetBit(px, py)) & 1;
+            }
+
+            // Bounds checked: everything outside the map collides.
+            inline bool Collides(int x, int y) const
+            {
+                return IsInPadding(x, y) ? Get(x, y) : true;
+            }
+
+            inline void Set(int x, int y, bool occupied)
+            {
+                const int px = x + PADDING;
+                const int py = y + PADDING;
+                uint64_t& tile = tiles[GetTileIdx(px >> TILE_SHIFT, py >> TILE_SHIFT)];
+                const uint64_t bit = (uint64_t)1 << GetBit(px, py);
+                tile = occupied ? (tile | bit) : (tile & ~bit);
+            }
+
+            // The word holding the tile that contains (x, y). (x, y) must be
+            // within PADDING of the map.
+            inline uint64_t GetTile(int x, int y) const
+            {
+                return tiles[GetTileIdx((x + PADDING) >> TILE_SHIFT, (y + PADDING) >> TILE_SHIFT)];
+            }
+
+            inline bool IsTileEmpty(int x, int y) const
+            {
+                return GetTile(x, y) == 0;
+            }
+
+            // Chessboard distance, in tiles, from the tile containing (x, y)
+            // to the nearest tile with an occupied cell, padding included. 0
+            // means the tile itself is occupied; k > 0 means every tile within
+            // k - 1 of it is empty. (x, y) must be within PADDING of the map.
+            inline int GetTileClearance(int x, int y) const
+            {
+                return clearance[((x + PADDING) >> TILE_SHIFT) + ((y + PADDING) >> TILE_SHIFT) * tilesWide];
+            }
+
+            // Two pass chamfer transform over the tile grid. Call after the
+            // last Set.
+            void ComputeClearance()
+            {
+                const int far = 255;
+                for(int ty = 0; ty < tilesHigh; ty++)
+                {
+                    for(int tx = 0; tx < tilesWide; tx++)
+                    {
+                        int d = tiles[GetTileIdx(tx, ty)] != 0 ? 0 : far;
+                        for(int ox = -1; ox <= 1 && ty > 0; ox++)
+                        {
+                            if(tx + ox >= 0 && tx + ox < tilesWide)
+                            {
+                                d = std::min(d, clearance[(tx + ox) + (ty - 1) * tilesWide] + 1);
+                            }
+                        }
+                        if(tx > 0)
+                        {
+                            d = std::min(d, clearance[(tx - 1) + ty * tilesWide] + 1);
+                        }
+                        clearance[tx + ty * tilesWide] = d;
+                    }
+                }
+
+                for(int ty = tilesHigh - 1; ty >= 0; ty--)
+                {
+                    for(int tx = tilesWide - 1; tx >= 0; tx--)
+                    {
+                        int d = clearance[tx + ty * tilesWide];
+                        for(int ox = -1; ox <= 1 && ty < tilesHigh - 1; ox++)
+                        {
+                            if(tx + ox >= 0 && tx + ox < tilesWide)
+                            {
+                                d = std::min(d, clearance[(tx + ox) + (ty + 1) * tilesWide] + 1);
+                            }
+                        }
+                        if(tx < tilesWide - 1)
+                        {
+                            d = std::min(d, clearance[(tx + 1) + ty * tilesWide] + 1);
+                        }
+                        clearance[tx + ty * tilesWide] = d;
+                    }
+                }
+            }
+
+            int width;
+            int height;
+            int tilesWide;
+            int tilesHigh;
+            int groupsWide;
+            Layout layout;
+            std::vector<uint64_t> tiles;
+            std::vector<unsigned char> clearance;
+
+        protected:
+            inline size_t GetTileIdx(int tx, int ty) const
+            {
+                if(layout == RowMajor)
+                {
+                    return tx + ty * tilesWide;
+                }
+                const size_t group = (tx >> TILE_SHIFT) + (ty >> TILE_SHIFT) * groupsWide;
+                return (group << (2 * TILE_SHIFT)) | Interleave(tx & TILE_MASK, ty & TILE_MASK);
+            }
+
+            // Morton code of two 3 bit coordinates.
+            static inline size_t Interleave(int x, int y)
+            {
+                return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+            }
+
+            static inline int GetBit(int px, int py)
+            {
+                return (px & TILE_MASK) | ((py & TILE_MASK) << TILE_SHIFT);
+            }
+    };
+}
+
+#endif // OCCUPANCYGRID_H_
@@ -0,0 +1,283 @@
+#ifndef PARTICLEFILTER_H_
+#define PARTICLEFILTER_H_
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include "ofMain.h"
+#include "Robot.h"
+#include "ThreadPool.h"
+
+namespace arm_slam
+{
+    // Tracks the joint configuration of a Robot<N> with a set of weighted
+    // hypotheses. Predict moves every particle by the odometry change plus
+    // Gaussian noise, Update weighs each particle by how well the scan fits
+    // the map from its camera pose, and the particles are redrawn by low
+    // variance resampling once the weights degenerate. Only the likelihoods
+    // run on several threads; all random numbers are drawn on the calling
+    // thread from a seeded generator, so results don't depend on numThreads.
+    template <size_t N> class ParticleFilter
+    {
+        public:
+            typedef typename Robot<N>::Config Config;
+            typedef typename Robot<N>::Pose Pose;
+
+            ParticleFilter() :
+                numParticles(256),
+                motionNoise(0.05f),
+                minMotionNoise(0.001f),
+                initialSpread(0.0f),
+                sigma(8.0f),
+                pointStride(2),
+                priorPoints(1.0f),
+                resampleThreshold(0.5f),
+                numThreads(1),
+                initialized(false)
+            {
+
+            }
+
+            virtual ~ParticleFilter()
+            {
+
+            }
+
+            // Scatters the particles around q, initialSpread apart in every
+            // joint, with q reported by odometry as odometry.
+            void Initialize(const Config& q, const Config& odometry, unsigned int seed = 0)
+            {
+                rng.seed(seed);
+                particles.assign(numParticles, q);
+                if(initialSpread > 0.0f)
+                {
+                    std::normal_distribution<float> noise(0.0f, initialSpread);
+                    for(size_t i = 0; i < particles.size(); i++)
+                    {
+                        for(size_t k = 0; k < N; k++)
+                        {
+                            particles[i][k] += noise(rng);
+                        }
+                    }
+                }
+                weights.assign(numParticles, 1.0f / numParticles);
+                logWeights.assign(numParticles, 0.0f);
+                lastOdometry = odometry;
+                estimate = q;
+                initialized = true;
+            }
+
+            void Predict(const Config& odometry)
+            {
+                const Config delta = odometry + lastOdometry * -1.0f;
+                lastOdometry = odometry;
+                std::normal_distribution<float> noise(0.0f, 1.0f);
+                float spread[N];
+                for(size_t k = 0; k < N; k++)
+                {
+                    spread[k] = motionNoise * fabsf(delta[k]) + minMotionNoise;
+                }
+                for(size_t i = 0; i < particles.size(); i++)
+                {
+                    particles[i] += delta;
+                    for(size_t k = 0; k < N; k++)
+                    {
+                        particles[i][k] += spread[k] * noise(rng);
+                    }
+                }
+            }
+
+            // Weighs every particle by exp(-sum(d^2) / (2 sigma^2)) over
+            // every pointStride-th point of points, given in the camera frame,
+            // where d is the map distance at the point placed by the
+            // particle's camera pose. Points on cells the map hasn't observed
+            // often enough have no d; see ComputeSquaredError for how they
+            // are scored. robot only provides link lengths and base. map is
+            // read from several threads, so its reads must not modify it.
+            template <typename T> void Update(const Robot<N>& robot, const std::vector<ofVec2f>& points, T& map)
+            {
+                const size_t n = particles.size();
+                if(n == 0)
+                {
+                    return;
+                }
+
+                poses.resize(n);
+                logLikelihoods.resize(n);
+                numObserved.resize(n);
+                robot.ComputeForwardKinematicsBatch(&particles[0], n, &poses[0], numThreads);
+                ParallelFor(0, n, numThreads, [this, &points, &map](size_t begin, size_t end)
+                {
+                    for(size_t i = begin; i < end; i++)
+                    {
+                        logLikelihoods[i] = ComputeSquaredError(poses[i], points, map, numObserved[i]);
+                    }
+                });
+
+                // A particle's error per observed point is taken as the
+                // mean of its own and priorPoints more points at the mean
+                // of every particle, then scaled up to all points. A
+                // particle that observes little can't then beat one that
+                // aligns many points, nor one that observes nothing beat
+                // the average.
+                double sumErrors = 0.0;
+                size_t sumObserved = 0;
+                for(size_t i = 0; i < n; i++)
+                {
+                    sumErrors += logLikelihoods[i];
+                    sumObserved += numObserved[i];
+                }
+                const float meanError = sumObserved > 0 ? (float)(sumErrors / sumObserved) : 0.0f;
+                const size_t numSampled = (points.size() + pointStride - 1) / pointStride;
+                const float scale = -0.5f / (sigma * sigma);
+                for(size_t i = 0; i < n; i++)
+                {
+                    logLikelihoods[i] = scale * (logLikelihoods[i] + priorPoints * meanError) * numSampled / (numObserved[i] + priorPoints);
+                }
+
+                // Weights are kept as logs and are relative, so shift by
+                // the largest to keep exp in range. A particle whose weight
+                // underflows can then still come back, and the best always
+                // has weight 1 before normalizing.
+                for(size_t i = 0; i < n; i++)
+                {
+                    logWeights[i] += logLikelihoods[i];
+                }
+                float best = logWeights[0];
+                for(size_t i = 1; i < n; i++)
+                {
+                    best = std::max(best, logWeights[i]);
+                }
+
+                float total = 0.0f;
+                for(size_t i = 0; i < n; i++)
+                {
+                    logWeights[i] -= best;
+                    weights[i] = expf(logWeights[i]);
+                    total += weights[i];
+                }
+
+                // Only a NaN or infinite likelihood gets here; start over
+                // from uniform weights rather than carry it on.
+                if(!(total > 0.0f) || !std::isfinite(total))
+                {
+                    logWeights.assign(n, 0.0f);
+                    weights.assign(n, 1.0f);
+                    total = (float)n;
+                }
+
+                float sumSquares = 0.0f;
+                estimate = Config();
+                for(size_t i = 0; i < n; i++)
+                {
+                    weights[i] /= total;
+                    sumSquares += weights[i] * weights[i];
+                    estimate += particles[i] * weights[i];
+                }
+
+                if(1.0f / sumSquares < resampleThreshold * n)
+                {
+                    Resample();
+                }
+            }
+
+            // Draws n particles with one random offset and n evenly spaced
+            // pointers into the cumulative weights, which keeps every
+            // particle of weight above 1 / n and adds less variance than n
+            // independent draws.
+            void Resample()
+            {
+                const size_t n = particles.size();
+                const float step = 1.0f / n;
+                std::uniform_real_distribution<float> start(0.0f, step);
+                float u = start(rng);
+                float cumulative = weights[0];
+                size_t j = 0;
+                resampled.resize(n);
+                for(size_t i = 0; i < n; i++)
+                {
+                    while(u > cumulative && j + 1 < n)
+                    {
+                        j++;
+                        cumulative += weights[j];
+                    }
+                    resampled[i] = particles[j];
+                    u += step;
+                }
+                particles.swap(resampled);
+                weights.assign(n, step);
+                logWeights.assign(n, 0.0f);
+            }
+
+            // Weighted mean of the particles at the last Update.
+            inline const Config& GetEstimate() const
+            {
+                return estimate;
+            }
+
+            // Sum of squared map distances of the sampled points seen from
+            // pose, over the num points that land on cells the map has
+            // observed often enough. Scoring the others at a fixed penalty
+            // as large as the truncation distance would favor poses that
+            // look at the known part of the map over poses that align
+            // with it.
+            template <typename T> float ComputeSquaredError(const Pose& pose, const std::vector<ofVec2f>& points, T& map, size_t& num) const
+            {
+                const float c = cosf(-pose.rotation);
+                const float s = sinf(-pose.rotation);
+                float sum = 0.0f;
+                num = 0;
+                for(size_t i = 0; i < points.size(); i += pointStride)
+                {
+                    const ofVec2f& p = points[i];
+                    const float x = pose.translation.x + p.x * c - p.y * s;
+                    const float y = pose.translation.y + p.x * s + p.y * c;
+                    if(map.GetWeight((int)x, (int)y) <= 2)
+                    {
+                        continue;
+                    }
+                    const float d = map.GetDist((int)x, (int)y);
+                    sum += d * d;
+                    num++;
+                }
+                return sum;
+            }
+
+            size_t numParticles;
+            // Standard deviation of the noise added to a joint angle by
+            // Predict is motionNoise times the joint's odometry change plus
+            // minMotionNoise.
+            float motionNoise;
+            float minMotionNoise;
+            // Standard deviation of each joint of the particles around the
+            // configuration given to Initialize.
+            float initialSpread;
+            // Standard deviation of a point's map distance.
+            float sigma;
+            size_t pointStride;
+            // Weight, in points, of the mean over every particle in each
+            // particle's error; see Update.
+            float priorPoints;
+            // Resample once the effective number of particles drops below
+            // this fraction of all particles.
+            float resampleThreshold;
+            size_t numThreads;
+            bool initialized;
+            std::vector<Config> particles;
+            // Normalized weights as of the last Update or Resample.
+            std::vector<float> weights;
+
+        protected:
+            std::mt19937 rng;
+            Config lastOdometry;
+            Config estimate;
+            std::vector<Pose> poses;
+            std::vector<float> logLikelihoods;
+            // Log weights, up to a shared offset: the best is 0.
+            std::vector<float> logWeights;
+            std::vector<size_t> numObserved;
+            std::vector<Config> resampled;
+    };
+}
+
+#endif // PARTICLEFILTER_H_
@@ -0,0 +1,206 @@
+#include "Profiler.h"
+#include "ofMain.h"
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+
+namespace arm_slam
+{
+
+    Profiler::Profiler() :
+            epoch(Clock::now()),
+            nextEvent(0),
+            eventsWrapped(false)
+    {
+        events.reserve(MAX_EVENTS);
+    }
+
+    Profiler& Profiler::Get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    uint32_t Profiler::GetThreadIndex()
+    {
+        static std::atomic<uint32_t> numThreads(0);
+        thread_local uint32_t index = numThreads++;
+        return index;
+    }
+
+    size_t Profiler::RegisterStage(const char* name)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            if (stages[i].name == name)
+            {
+                return i;
+            }
+        }
+
+        Stage stage;
+        stage.name = name;
+        stage.next = 0;
+        stages.push_back(stage);
+        return stages.size() - 1;
+    }
+
+    void Profiler::Record(size_t stage, Clock::time_point start, Clock::time_point end)
+    {
+        Event event;
+        event.stage = (uint32_t)stage;
+        event.thread = GetThreadIndex();
+        event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count();
+        event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        Stage& s = stages[stage];
+        const float ms = event.duration * 1e-6f;
+        if (s.window.size() < WINDOW)
+        {
+            s.window.push_back(ms);
+        }
+        else
+        {
+            s.window[s.next] = ms;
+        }
+        s.next = (s.next + 1) % WINDOW;
+
+        if (events.size() < MAX_EVENTS)
+        {
+            events.push_back(event);
+        }
+        else
+        {
+            events[nextEvent] = event;
+            eventsWrapped = true;
+        }
+        nextEvent = (nextEvent + 1) % MAX_EVENTS;
+    }
+
+    size_t Profiler::GetNumStages() const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return stages.size();
+    }
+
+    std::string Profiler::GetStageName(size_t stage) const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return stages[stage].name;
+    }
+
+    Profiler::Stats Profiler::GetStats(size_t stage) const
+    {
+        std::vector<float> sorted;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            sorted = stages[stage].window;
+        }
+
+        Stats stats;
+        stats.count = sorted.size();
+        stats.mean = 0.0f;
+        stats.median = 0.0f;
+        stats.p95 = 0.0f;
+        stats.max = 0.0f;
+        std::fill(stats.buckets, stats.buckets + NUM_BUCKETS, 0);
+        if (sorted.empty())
+        {
+            return stats;
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+        float sum = 0.0f;
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            sum += sorted[i];
+            const float us = sorted[i] * 1000.0f;
+            size_t bucket = 0;
+            while (bucket + 1 < NUM_BUCKETS && us >= (float)(2u << bucket))
+            {
+                bucket++;
+            }
+            stats.buckets[bucket]++;
+        }
+        stats.mean = sum / sorted.size();
+        stats.median = sorted[sorted.size() / 2];
+        stats.p95 = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+        stats.max = sorted.back();
+        return stats;
+    }
+
+    void Profiler::Draw(float x, float y) const
+    {
+        const size_t numStages = GetNumStages();
+        const float lineHeight = 14.0f;
+        const float barX = x + 340.0f;
+        const float barWidth = 6.0f;
+        const float barHeight = lineHeight - 3.0f;
+
+        ofSetColor(0, 0, 0, 180);
+        ofDrawRectangle(x - 4, y - lineHeight, barX - x + NUM_BUCKETS * barWidth + 8, (numStages + 1) * lineHeight + 6);
+        ofSetColor(255, 255, 255);
+        ofDrawBitmapString("stage          mean  median     p95     max  ms", x, y);
+        for (size_t i = 0; i < numStages; i++)
+        {
+            const Stats stats = GetStats(i);
+            const float rowY = y + (i + 1) * lineHeight;
+            char line[128];
+            snprintf(line, sizeof(line), "%-12.12s %6.2f  %6.2f  %6.2f  %6.2f", GetStageName(i).c_str(), stats.mean, stats.median, stats.p95, stats.max);
+            ofSetColor(255, 255, 255);
+            ofDrawBitmapString(line, x, rowY);
+
+            // One bar per bucket, scaled to the fullest bucket.
+            uint32_t fullest = 1;
+            for (size_t b = 0; b < NUM_BUCKETS; b++)
+            {
+                fullest = std::max(fullest, stats.buckets[b]);
+            }
+            ofSetColor(100, 200, 255);
+            for (size_t b = 0; b < NUM_BUCKETS; b++)
+            {
+                const float h = barHeight * stats.buckets[b] / fullest;
+                ofDrawRectangle(barX + b * barWidth, rowY - h, barWidth - 1, h);
+            }
+        }
+    }
+
+    bool Profiler::SaveTrace(const std::string& file) const
+    {
+        FILE* stream = fopen(file.c_str(), "w");
+        if (!stream)
+        {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        fprintf(stream, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        const size_t first = eventsWrapped ? nextEvent : 0;
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            const Event& event = events[(first + i) % events.size()];
+            // Stage names are string literals from the source, so they
+            // need no escaping.
+            fprintf(stream, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}\n",
+                    i == 0 ? "" : ",", stages[event.stage].name.c_str(), event.thread, event.start * 1e-3, event.duration * 1e-3);
+        }
+        fprintf(stream, "]}\n");
+        return fclose(stream) == 0;
+    }
+
+    void Profiler::Clear()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            stages[i].window.clear();
+            stages[i].next = 0;
+        }
+        events.clear();
+        nextEvent = 0;
+        eventsWrapped = false;
+    }
+
+}
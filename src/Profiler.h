@@ -0,0 +1,133 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+
+namespace arm_slam
+{
+    // Wall time of named pipeline stages, recorded by ARM_SLAM_PROFILE_SCOPE.
+    // Each stage keeps a rolling window of its last WINDOW durations for
+    // the overlay, and every timing also goes into a ring of the last
+    // MAX_EVENTS events that SaveTrace writes as Chrome trace events, for
+    // chrome://tracing or Perfetto. Stages nest, so a trace shows which
+    // stage of a slow frame was slow. Recording takes a lock, so timers
+    // belong around whole stages, not inside per point loops.
+    class Profiler
+    {
+        public:
+            typedef std::chrono::steady_clock Clock;
+
+            static const size_t WINDOW = 256;
+            // Bucket b counts durations in [2^b, 2^(b + 1)) microseconds; the
+            // first and last also take everything below and above.
+            static const size_t NUM_BUCKETS = 16;
+            static const size_t MAX_EVENTS = 1 << 16;
+
+            struct Stats
+            {
+                    size_t count;
+                    // Milliseconds over the window.
+                    float mean;
+                    float median;
+                    float p95;
+                    float max;
+                    uint32_t buckets[NUM_BUCKETS];
+            };
+
+            // The process wide profiler the macro records into.
+            static Profiler& Get();
+
+            // True if ARM_SLAM_ENABLE_PROFILING was defined for this file.
+            // Only the translation units that define it record anything.
+            static inline bool IsCompiledIn()
+            {
+#ifdef ARM_SLAM_ENABLE_PROFILING
+                return true;
+#else
+                return false;
+#endif
+            }
+
+            // Returns the id of the stage called name, adding it if needed.
+            size_t RegisterStage(const char* name);
+            void Record(size_t stage, Clock::time_point start, Clock::time_point end);
+
+            size_t GetNumStages() const;
+            std::string GetStageName(size_t stage) const;
+            Stats GetStats(size_t stage) const;
+
+            // Draws a table of the stage statistics with a histogram bar per
+            // stage, top left at (x, y).
+            void Draw(float x, float y) const;
+            bool SaveTrace(const std::string& file) const;
+            void Clear();
+
+        protected:
+            Profiler();
+
+            struct Stage
+            {
+                    std::string name;
+                    // Milliseconds, oldest overwritten first.
+                    std::vector<float> window;
+                    size_t next;
+            };
+
+            struct Event
+            {
+                    uint32_t stage;
+                    uint32_t thread;
+                    // Nanoseconds since epoch.
+                    int64_t start;
+                    int64_t duration;
+            };
+
+            static uint32_t GetThreadIndex();
+
+            mutable std::mutex mutex;
+            Clock::time_point epoch;
+            std::vector<Stage> stages;
+            std::vector<Event> events;
+            size_t nextEvent;
+            bool eventsWrapped;
+    };
+
+    // Records the lifetime of the timer as one sample of stage.
+    class ScopedTimer
+    {
+        public:
+            ScopedTimer(size_t stage_) :
+                stage(stage_),
+                start(Profiler::Clock::now())
+            {
+
+            }
+
+            ~ScopedTimer()
+            {
+                Profiler::Get().Record(stage, start, Profiler::Clock::now());
+            }
+
+        protected:
+            size_t stage;
+            Profiler::Clock::time_point start;
+    };
+}
+
+// Times the rest of the enclosing scope as the stage called name, a string
+// literal. Compiles to nothing unless ARM_SLAM_ENABLE_PROFILING is defined.
+#ifdef ARM_SLAM_ENABLE_PROFILING
+#define ARM_SLAM_PROFILE_CONCAT_(a, b) a##b
+#define ARM_SLAM_PROFILE_CONCAT(a, b) ARM_SLAM_PROFILE_CONCAT_(a, b)
+#define ARM_SLAM_PROFILE_SCOPE(name) \
+    static const size_t ARM_SLAM_PROFILE_CONCAT(profileStage, __LINE__) = arm_slam::Profiler::Get().RegisterStage(name); \
+    arm_slam::ScopedTimer ARM_SLAM_PROFILE_CONCAT(profileTimer, __LINE__)(ARM_SLAM_PROFILE_CONCAT(profileStage, __LINE__))
+#else
+#define ARM_SLAM_PROFILE_SCOPE(name) do {} while (0)
+#endif
+
+#endif // PROFILER_H_
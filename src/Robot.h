@@ -10,6 +10,10 @@
 #include "Joint.h"
 #include "DepthCamera.h"
 #include "BasicMat.h"
+#include "KinematicChain.h"
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 namespace arm_slam
 {
     template <size_t N> class Robot
@@ -18,6 +22,7 @@ namespace arm_slam
             typedef Robot<N> Type;
             typedef BasicMat<2, N> LinearJacobian;
             typedef BasicMat<N, 1> Config;
+            typedef typename KinematicChain<N>::Pose Pose;
             Robot() :
                 root(0x0),
                 camera(0x0)
@@ -45,6 +50,7 @@ namespace arm_slam
 
             void Draw(bool drawCamera)
             {
+                SyncNodes();
                 root->DrawRecursive();
 
                 if(drawCamera)
@@ -55,14 +61,57 @@ namespace arm_slam
 
             void Update(arm_slam::World& map)
             {
+                UpdateKinematics();
+                camera->Update(map);
+            }
+
+            // Recomputes the poses of the last SetQ. Only the chain and the
+            // camera are updated, the rest of the Node tree is a drawing view
+            // brought up to date by Draw.
+            void UpdateKinematics()
+            {
+                chain.Update();
+                camera->globalTranslation = chain.GetCameraTranslation();
+                camera->globalRotation = chain.GetCameraRotation();
+            }
+
+            // Copies the chain's poses into the Node tree.
+            void SyncNodes()
+            {
+                root->globalTranslation = chain.GetJointTranslation(0);
+                root->globalRotation = chain.baseRotation;
                 for(size_t i = 0; i < N; i++)
                 {
+                    joints[i]->q = chain.q[i];
                     joints[i]->Update();
+                    joints[i]->globalTranslation = chain.GetJointTranslation(i);
+                    joints[i]->globalRotation = chain.GetJointRotation(i);
                 }
 
-                root->UpdateRecursive();
+                for(size_t i = 0; i < N + 1; i++)
+                {
+                    links[i]->globalTranslation = chain.GetLinkTranslation(i);
+                    links[i]->globalRotation = chain.GetLinkRotation(i);
+                }
+            }
 
-                camera->Update(map);
+            void SetBase(const ofVec2f& translation, float rotation = 0.0f)
+            {
+                chain.SetBase(translation, rotation);
+                root->localTranslation = translation;
+                root->localRotation = rotation;
+            }
+
+            inline const ofVec2f& GetBase() const
+            {
+                return chain.base;
+            }
+
+            // Camera pose of each of the n configurations qs, without
+            // changing this robot. See KinematicChain::ComputeBatch.
+            void ComputeForwardKinematicsBatch(const Config* qs, size_t n, Pose* out, size_t numThreads = 1) const
+            {
+                chain.ComputeBatch(qs, n, out, numThreads);
             }
 
             inline const Config& GetQ() const
@@ -75,14 +124,14 @@ namespace arm_slam
                 q = q_;
                 for(size_t i = 0; i < N; i++)
                 {
-                    joints[i]->q = q[i];
-                    joints[i]->Update();
+                    chain.q[i] = q[i];
                 }
             }
 
 
             void Initialize(float* lengths)
             {
+                chain.SetLengths(lengths);
                 root = new Node();
                 Node* last = root;
                 for(size_t i = 0; i < N + 1; i++)
@@ -112,12 +161,12 @@ namespace arm_slam
 
             ofVec2f ComputeForwardKinematics(const ofVec2f& eeOffset)
             {
-                return links[N]->globalTranslation + eeOffset.rotateRad(links[N]->globalRotation);
+                return chain.GetLinkTranslation(N) + eeOffset.rotateRad(chain.GetLinkRotation(N));
             }
 
             ofVec2f GetEEPos()
             {
-                return links[N]->globalTranslation;
+                return chain.GetLinkTranslation(N);
             }
 
             Config ComputeJacobianTransposeMove(const ofVec2f& force)
@@ -134,8 +183,8 @@ namespace arm_slam
                 ofVec3f on = ofVec3f(globalPos.x, globalPos.y, 0);
                 for(size_t i = 0; i < N; i++)
                 {
-                    Joint* joint = joints[i];
-                    ofVec3f oi = ofVec3f(joint->globalTranslation.x, joint->globalTranslation.y, 0);
+                    const ofVec2f& joint = chain.GetJointTranslation(i);
+                    ofVec3f oi = ofVec3f(joint.x, joint.y, 0);
                     ofVec3f j_vi = zi.crossed(on - oi);
                     jacobian(0, i) = j_vi.x;
                     jacobian(1, i) = j_vi.y;
@@ -145,20 +194,72 @@ namespace arm_slam
 
             }
 
+            // Sum over the scan of ComputeLinearJacobian(p_i)^T g_i, where
+            // p_i is localPoints[i] placed by the camera pose, in one pass.
+            // Column k of the Jacobian dotted with g is (p - o_k) x g. With
+            // p = t + R l that is (R l) x g + (t - o_k) x g, and
+            // (R l) x g = cos(a) (l x g) - sin(a) (l . g), so the scan only
+            // contributes sum(l x g), sum(l . g) and sum(g).
+            Config ComputeJacobianTransposeSum(const std::vector<ofVec2f>& localPoints, const std::vector<ofVec2f>& gradients)
+            {
+                const size_t n = std::min(localPoints.size(), gradients.size());
+                const float* l = n > 0 ? &localPoints[0].x : 0x0;
+                const float* g = n > 0 ? &gradients[0].x : 0x0;
+                float cross = 0.0f;
+                float dot = 0.0f;
+                float gx = 0.0f;
+                float gy = 0.0f;
+                size_t i = 0;
+#ifdef __AVX__
+                // Four interleaved (x, y) pairs per register.
+                const __m256 sign = _mm256_set_ps(-1, 1, -1, 1, -1, 1, -1, 1);
+                __m256 crossV = _mm256_setzero_ps();
+                __m256 dotV = _mm256_setzero_ps();
+                __m256 gV = _mm256_setzero_ps();
+                for(; i + 4 <= n; i += 4)
+                {
+                    const __m256 lv = _mm256_loadu_ps(l + 2 * i);
+                    const __m256 gv = _mm256_loadu_ps(g + 2 * i);
+                    dotV = _mm256_add_ps(dotV, _mm256_mul_ps(lv, gv));
+                    crossV = _mm256_add_ps(crossV, _mm256_mul_ps(_mm256_mul_ps(lv, _mm256_permute_ps(gv, 0xB1)), sign));
+                    gV = _mm256_add_ps(gV, gv);
+                }
+                float lanes[8];
+                _mm256_storeu_ps(lanes, crossV);
+                cross = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+                _mm256_storeu_ps(lanes, dotV);
+                dot = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+                _mm256_storeu_ps(lanes, gV);
+                gx = lanes[0] + lanes[2] + lanes[4] + lanes[6];
+                gy = lanes[1] + lanes[3] + lanes[5] + lanes[7];
+#endif
+                for(; i < n; i++)
+                {
+                    const float lx = l[2 * i];
+                    const float ly = l[2 * i + 1];
+                    const float x = g[2 * i];
+                    const float y = g[2 * i + 1];
+                    cross += lx * y - ly * x;
+                    dot += lx * x + ly * y;
+                    gx += x;
+                    gy += y;
+                }
+
+                const float rotated = cosf(-camera->globalRotation) * cross - sinf(-camera->globalRotation) * dot;
+                Config sum;
+                for(size_t k = 0; k < N; k++)
+                {
+                    const ofVec2f r = chain.GetCameraTranslation() - chain.GetJointTranslation(k);
+                    sum[k] = rotated + r.x * gy - r.y * gx;
+                }
+                return sum;
+            }
+
             template <typename T> void GradientDescent(int iters, float rate, T& map)
             {
                 for(int i = 0; i < iters; i++)
                 {
-                    Config gradient;
-
-                    for (size_t i = 0; i < camera->gradients.size(); i++)
-                    {
-                        const ofVec2f gi = camera->gradients.at(i);
-                        const ofVec2f pi = camera->noisyPoints.at(i).getRotatedRad(-camera->globalRotation) + camera->globalTranslation;
-                        LinearJacobian J = ComputeLinearJacobian(pi);
-                        Config g = J.Transpose() * MatFromVec2(gi);
-                        gradient += g;
-                    }
+                    Config gradient = ComputeJacobianTransposeSum(camera->noisyPoints, camera->gradients);
 
                     if(camera->gradients.size() > 0)
                     {
@@ -170,12 +271,169 @@ namespace arm_slam
                 }
             }
 
+            // Levenberg-Marquardt on the mean squared map distance of the
+            // camera's noisy points. Every point with a trusted distance adds
+            // the row grad(d)^T dp/dq to the normal equations, which are
+            // solved with a Cholesky after damping their diagonal by lambda.
+            // A step is kept if it lowers the total over the points trusted
+            // before it. Stops after iters iterations or once an accepted step moves no
+            // joint by more than tolerance. Returns the iterations run.
+            template <typename T> int GaussNewton(int iters, float lambda, float tolerance, T& map)
+            {
+                if(map.IsSamplingInterpolated())
+                {
+                    return GaussNewton<true>(iters, lambda, tolerance, map);
+                }
+                return GaussNewton<false>(iters, lambda, tolerance, map);
+            }
+
+            // GaussNewton with the map sampler fixed at compile time, so
+            // the per point loop of BuildNormalEquations doesn't branch on
+            // it and reads cells exactly as before sub-cell sampling.
+            template <bool interpolated, typename T> int GaussNewton(int iters, float lambda, float tolerance, T& map)
+            {
+                UpdateKinematics();
+                BasicMat<N, N> H;
+                Config b;
+                float cost = 0.0f;
+                float unused = 0.0f;
+                if(!BuildNormalEquations<interpolated>(map, H, b, cost, residuals, NULL, unused))
+                {
+                    return 0;
+                }
+
+                int i = 0;
+                while(i < iters)
+                {
+                    i++;
+                    BasicMat<N, N> damped = H;
+                    for(size_t k = 0; k < N; k++)
+                    {
+                        damped(k, k) += lambda * H(k, k) + 1e-6f;
+                    }
+
+                    Config step;
+                    if(!damped.CholeskySolve(b * -1.0f, step))
+                    {
+                        lambda *= 10.0f;
+                        continue;
+                    }
+
+                    Config prev = q;
+                    SetQ(q + step);
+                    UpdateKinematics();
+
+                    // The step is judged on the points trusted before it, so
+                    // it can't gain by moving badly aligned points off the
+                    // observed part of the map.
+                    BasicMat<N, N> nextH;
+                    Config nextB;
+                    float nextCost = 0.0f;
+                    float stepCost = 0.0f;
+                    if(BuildNormalEquations<interpolated>(map, nextH, nextB, nextCost, nextResiduals, &residuals, stepCost) && stepCost < cost)
+                    {
+                        H = nextH;
+                        b = nextB;
+                        cost = nextCost;
+                        residuals.swap(nextResiduals);
+                        lambda *= 0.1f;
+
+                        float largest = 0.0f;
+                        for(size_t k = 0; k < N; k++)
+                        {
+                            largest = std::max(largest, fabsf(step[k]));
+                        }
+                        if(largest < tolerance)
+                        {
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        SetQ(prev);
+                        UpdateKinematics();
+                        lambda *= 10.0f;
+                    }
+                }
+
+                camera->ComputeGradients(map, true);
+                return i;
+            }
+
+            // Normal equations H = sum(j j^T), b = sum(j d) of the points with
+            // a trusted distance d, normalized by their count, where j is the
+            // gradient of d with respect to q. cost is the sum of d^2, and
+            // residuals holds each point's d^2, or -1 if it isn't trusted.
+            // If reference holds the residuals at another pose,
+            // referenceCost sums d^2 over the points trusted there instead,
+            // keeping the old residual of those no longer trusted. The
+            // kinematics must be up to date. Returns false if no point has a
+            // trusted distance. Points are sampled with SampleDistGradient if
+            // interpolated is set, otherwise from the cell containing them.
+            template <bool interpolated, typename T> bool BuildNormalEquations(T& map, BasicMat<N, N>& H, Config& b, float& cost, std::vector<float>& residuals, const std::vector<float>* reference, float& referenceCost)
+            {
+                H = BasicMat<N, N>();
+                b = Config();
+                cost = 0.0f;
+                referenceCost = 0.0f;
+                residuals.assign(camera->noisyPoints.size(), -1.0f);
+                size_t num = 0;
+                for(size_t i = 0; i < camera->noisyPoints.size(); i++)
+                {
+                    const ofVec2f pi = camera->noisyPoints.at(i).getRotatedRad(-camera->globalRotation) + camera->globalTranslation;
+                    float d;
+                    ofVec2f g;
+                    const bool trusted = interpolated ? map.SampleDistGradient(pi.x, pi.y, d, g) : map.GetDistGradient((int)pi.x, (int)pi.y, d, g);
+                    if(reference && (*reference)[i] >= 0.0f)
+                    {
+                        referenceCost += trusted ? d * d : (*reference)[i];
+                    }
+                    if(!trusted)
+                    {
+                        continue;
+                    }
+                    residuals[i] = d * d;
+
+                    // Joints rotate points clockwise in screen coordinates,
+                    // so dp/dq_k = -z x (p - o_k), the negated
+                    // ComputeLinearJacobian column.
+                    float j[N];
+                    for(size_t k = 0; k < N; k++)
+                    {
+                        const ofVec2f r = pi - chain.GetJointTranslation(k);
+                        j[k] = g.x * r.y - g.y * r.x;
+                    }
+
+                    for(size_t r = 0; r < N; r++)
+                    {
+                        for(size_t c = 0; c < N; c++)
+                        {
+                            H(r, c) += j[r] * j[c];
+                        }
+                        b[r] += j[r] * d;
+                    }
+                    cost += d * d;
+                    num++;
+                }
+
+                if(num == 0)
+                {
+                    return false;
+                }
+
+                const float norm = 1.0f / num;
+                H = H * norm;
+                b = b * norm;
+                return true;
+            }
+
             inline size_t GetDOF()
             {
                 return N;
             }
 
 
+            KinematicChain<N> chain;
             Node* root;
             Joint* joints[N];
             Link* links[N + 1];
@@ -184,6 +442,9 @@ namespace arm_slam
 
         protected:
             Config q;
+            // GaussNewton's residuals at the current and the trial pose.
+            std::vector<float> residuals;
+            std::vector<float> nextResiduals;
     };
 
 }
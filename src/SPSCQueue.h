@@ -0,0 +1,132 @@
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace arm_slam
+{
+    // Bounded lock free queue between exactly one producer thread and one
+    // consumer thread. Slots are allocated up front and reused, so pushing
+    // and popping items that own buffers, like vectors, stops allocating
+    // once every slot has been through a push. Begin/EndPush and
+    // Begin/EndPop read and write slots in place, without any copy.
+    template <typename T> class SPSCQueue
+    {
+        public:
+            SPSCQueue(size_t capacity = 16) :
+                head(0),
+                tail(0)
+            {
+                Reset(capacity);
+            }
+
+            // Empties the queue, rounds capacity up to a power of two and
+            // sets every slot to prototype. Not thread safe.
+            void Reset(size_t capacity, const T& prototype = T())
+            {
+                size_t size = 1;
+                while (size < std::max(capacity, (size_t)1))
+                {
+                    size <<= 1;
+                }
+                slots.assign(size, prototype);
+                mask = size - 1;
+                head.store(0);
+                tail.store(0);
+            }
+
+            // Producer only. Returns false if the queue is full.
+            bool TryPush(const T& item)
+            {
+                T* slot = BeginPush();
+                if (!slot)
+                {
+                    return false;
+                }
+                *slot = item;
+                EndPush();
+                return true;
+            }
+
+            // Consumer only. Swaps the oldest item into item, leaving item's
+            // old contents in the slot for a later push to reuse. Returns
+            // false if the queue is empty.
+            bool TryPop(T& item)
+            {
+                T* slot = BeginPop();
+                if (!slot)
+                {
+                    return false;
+                }
+                std::swap(item, *slot);
+                EndPop();
+                return true;
+            }
+
+            // Producer only. The slot the next push fills, holding whatever
+            // was last popped from it, or NULL if the queue is full. Nothing
+            // is queued until EndPush.
+            T* BeginPush()
+            {
+                const size_t t = tail.load(std::memory_order_relaxed);
+                if (t - head.load(std::memory_order_acquire) > mask)
+                {
+                    return NULL;
+                }
+                return &slots[t & mask];
+            }
+
+            void EndPush()
+            {
+                tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            // Consumer only. The oldest item, or NULL if the queue is empty.
+            // It stays valid, and queued, until EndPop.
+            T* BeginPop()
+            {
+                const size_t h = head.load(std::memory_order_relaxed);
+                if (h == tail.load(std::memory_order_acquire))
+                {
+                    return NULL;
+                }
+                return &slots[h & mask];
+            }
+
+            void EndPop()
+            {
+                head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            inline bool IsEmpty() const
+            {
+                return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+            }
+
+            inline size_t Size() const
+            {
+                return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+            }
+
+            inline size_t GetCapacity() const
+            {
+                return slots.size();
+            }
+
+        protected:
+            std::vector<T> slots;
+            size_t mask;
+            // Next slot to pop and to push. Each is written by one side only,
+            // and padded onto its own cache line so the two sides don't
+            // invalidate each other's.
+            char padHead[64];
+            std::atomic<size_t> head;
+            char padTail[64];
+            std::atomic<size_t> tail;
+            char padEnd[64];
+    };
+}
+
+#endif // SPSCQUEUE_H_
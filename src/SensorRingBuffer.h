@@ -0,0 +1,141 @@
+#ifndef SENSORRINGBUFFER_H_
+#define SENSORRINGBUFFER_H_
+
+#include <vector>
+#include "ofMain.h"
+#include "BasicMat.h"
+#include "SPSCQueue.h"
+
+namespace arm_slam
+{
+    // Hands sensor frames of an N joint arm from one producer, a simulator
+    // or a driver, to one SLAM consumer without locks or allocation. Every
+    // frame is allocated by Reset with room for maxPoints points, and both
+    // sides read and write frames in place.
+    template <size_t N> class SensorRingBuffer
+    {
+        public:
+            typedef BasicMat<N, 1> Config;
+
+            // One reading of the sensors: a scan in the camera frame with
+            // its noisy copy and the surface normal at each point, and the
+            // joint encoders. Only the first numPoints of each array are set.
+            struct Frame
+            {
+                    // Seconds on the producer's clock.
+                    double timestamp;
+                    Config joints;
+                    size_t numPoints;
+                    std::vector<ofVec2f> points;
+                    std::vector<ofVec2f> noisyPoints;
+                    std::vector<ofVec2f> normals;
+
+                    // Copies a scan into the frame. Returns false, leaving the
+                    // frame as is, if the arrays differ in size or exceed the
+                    // frame's capacity.
+                    bool SetScan(const std::vector<ofVec2f>& points_, const std::vector<ofVec2f>& noisyPoints_, const std::vector<ofVec2f>& normals_)
+                    {
+                        const size_t n = points_.size();
+                        if (noisyPoints_.size() != n || normals_.size() != n || n > points.size())
+                        {
+                            return false;
+                        }
+                        std::copy(points_.begin(), points_.end(), points.begin());
+                        std::copy(noisyPoints_.begin(), noisyPoints_.end(), noisyPoints.begin());
+                        std::copy(normals_.begin(), normals_.end(), normals.begin());
+                        numPoints = n;
+                        return true;
+                    }
+
+                    // Copies the scan out. Allocates only while the vectors
+                    // are still smaller than the largest scan read so far.
+                    void GetScan(std::vector<ofVec2f>& points_, std::vector<ofVec2f>& noisyPoints_, std::vector<ofVec2f>& normals_) const
+                    {
+                        points_.assign(points.begin(), points.begin() + numPoints);
+                        noisyPoints_.assign(noisyPoints.begin(), noisyPoints.begin() + numPoints);
+                        normals_.assign(normals.begin(), normals.begin() + numPoints);
+                    }
+            };
+
+            SensorRingBuffer(size_t capacity = 4, size_t maxPoints = 0) :
+                numSkipped(0)
+            {
+                Reset(capacity, maxPoints);
+            }
+
+            // Drops every frame and reallocates capacity frames, rounded up
+            // to a power of two, of maxPoints points each. Not thread safe.
+            void Reset(size_t capacity, size_t maxPoints_)
+            {
+                maxPoints = maxPoints_;
+                Frame prototype;
+                prototype.timestamp = 0.0;
+                prototype.numPoints = 0;
+                prototype.points.resize(maxPoints);
+                prototype.noisyPoints.resize(maxPoints);
+                prototype.normals.resize(maxPoints);
+                frames.Reset(capacity, prototype);
+                numSkipped = 0;
+            }
+
+            // Producer only. The frame to fill next, or NULL if the consumer
+            // has capacity frames left to read. EndWrite hands it over.
+            inline Frame* BeginWrite()
+            {
+                return frames.BeginPush();
+            }
+
+            inline void EndWrite()
+            {
+                frames.EndPush();
+            }
+
+            // Consumer only. The oldest unread frame, or NULL if there is
+            // none. It stays valid until EndRead.
+            inline const Frame* BeginRead()
+            {
+                return frames.BeginPop();
+            }
+
+            // Consumer only. As BeginRead, but first skips every frame older
+            // than the newest, for consumers that only want the latest.
+            const Frame* BeginReadLatest()
+            {
+                while (frames.Size() > 1)
+                {
+                    frames.EndPop();
+                    numSkipped++;
+                }
+                return frames.BeginPop();
+            }
+
+            inline void EndRead()
+            {
+                frames.EndPop();
+            }
+
+            inline size_t Size() const
+            {
+                return frames.Size();
+            }
+
+            inline size_t GetCapacity() const
+            {
+                return frames.GetCapacity();
+            }
+
+            inline size_t GetMaxPoints() const
+            {
+                return maxPoints;
+            }
+
+            // Frames BeginReadLatest skipped; written by the consumer.
+            size_t numSkipped;
+
+        protected:
+            SPSCQueue<Frame> frames;
+            size_t maxPoints;
+    };
+}
+
+#endif // SENSORRINGBUFFER_H_
@@ -0,0 +1,21 @@
+#include "SparseTSDF.h"
+
+namespace arm_slam
+{
+
+    SparseTSDF::SparseTSDF() :
+            truncation(0.0f),
+            width(0),
+            height(0),
+            lastKey(INVALID_KEY),
+            lastBlock(-1)
+    {
+
+    }
+
+    SparseTSDF::~SparseTSDF()
+    {
+
+    }
+
+}
@@ -0,0 +1,281 @@
+#ifndef SPARSETSDF_H_
+#define SPARSETSDF_H_
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "ofMain.h"
+#include "World.h"
+#include "TSDFCommon.h"
+namespace arm_slam
+{
+    // Voxel-hashed TSDF. Cells live in fixed size blocks that are allocated
+    // the first time a ray fuses into them; unallocated cells read as
+    // truncation distance with zero weight, exactly like untouched cells of
+    // the dense TSDF. Same interface as TSDF, so trackers can be templated on
+    // either. Reads are const and safe from any number of threads while
+    // nothing writes.
+    class SparseTSDF
+    {
+        public:
+            static const int BLOCK_SHIFT = 4;
+            static const int BLOCK_SIZE = 1 << BLOCK_SHIFT;
+            static const int BLOCK_MASK = BLOCK_SIZE - 1;
+            static const int BLOCK_CELLS = BLOCK_SIZE * BLOCK_SIZE;
+
+            struct Block
+            {
+                    int x;
+                    int y;
+                    float dist[BLOCK_CELLS];
+                    float weight[BLOCK_CELLS];
+            };
+
+            SparseTSDF();
+            virtual ~SparseTSDF();
+
+            void Initialize(int w, int h, float t)
+            {
+                width = w;
+                height = h;
+                truncation = t;
+                blocks.clear();
+                blockIndex.clear();
+                lastKey = INVALID_KEY;
+                lastBlock = -1;
+            }
+
+            void Initialize(World& world, float t)
+            {
+                Initialize(world.width, world.height, t);
+            }
+
+            // Paints the allocated blocks only; the rest of img is left as is.
+            void SetColors(ofImage* img)
+            {
+                for(size_t b = 0; b < blocks.size(); b++)
+                {
+                    const Block& block = blocks[b];
+                    for(int i = 0; i < BLOCK_CELLS; i++)
+                    {
+                        int x = block.x + (i & BLOCK_MASK);
+                        int y = block.y + (i >> BLOCK_SHIFT);
+                        if(IsValid(x, y))
+                        {
+                            img->setColor(x, y, TSDFCommon::GetColor(block.dist[i], block.weight[i], truncation));
+                        }
+                    }
+                }
+                img->update();
+            }
+
+            inline bool IsValid(int x, int y) const
+            {
+                return x >= 0 && x < width && y >= 0 && y < height;
+            }
+
+            inline void SetWeight(int x, int y, float value)
+            {
+                GetOrAllocate(x, y).weight[GetCellIdx(x, y)] = value;
+            }
+
+            inline void SetDist(int x, int y, float value)
+            {
+                GetOrAllocate(x, y).dist[GetCellIdx(x, y)] = value;
+            }
+
+            inline float GetWeight(int x, int y) const
+            {
+                if (IsValid(x, y))
+                {
+                    const Block* block = Find(x, y);
+                    return block ? block->weight[GetCellIdx(x, y)] : 0.0f;
+                }
+                else
+                {
+                    return 0.0f;
+                }
+            }
+
+            inline float GetDist(int x, int y) const
+            {
+                if (IsValid(x, y))
+                {
+                    const Block* block = Find(x, y);
+                    return block ? block->dist[GetCellIdx(x, y)] : truncation;
+                }
+                else
+                {
+                    return truncation;
+                }
+            }
+
+            inline ofVec2f GetGradient(int x, int y) const
+            {
+                return TSDFCommon::GetGradient(*this, x, y);
+            }
+
+            // Distance at (x, y) and its central difference gradient. Returns
+            // false, like GetGradient returns zero, where a neighbour has
+            // too little weight to trust.
+            inline bool GetDistGradient(int x, int y, float& d, ofVec2f& grad) const
+            {
+                return TSDFCommon::GetDistGradient(*this, x, y, d, grad);
+            }
+
+            // Interpolation is only implemented for the dense TSDF; this
+            // samples the cell containing the point.
+            inline bool SampleDistGradient(float x, float y, float& d, ofVec2f& grad) const
+            {
+                return GetDistGradient((int)x, (int)y, d, grad);
+            }
+
+            inline ofVec2f SampleGradient(float x, float y) const
+            {
+                return GetGradient((int)x, (int)y);
+            }
+
+            inline bool IsSamplingInterpolated() const
+            {
+                return false;
+            }
+
+            inline void FuseRayCloud(const ofVec2f& origin, const float& rotation, const std::vector<ofVec2f>& points, const std::vector<ofVec2f>& gradients)
+            {
+                TSDFCommon::FuseRayCloud(*this, origin, rotation, points, gradients);
+            }
+
+            inline float GetWeight(float t) const
+            {
+                return TSDFCommon::GetFusionWeight(truncation, t);
+            }
+
+            inline void FuseRay(const ofVec2f& origin, const ofVec2f& end, const ofVec2f& normal)
+            {
+                TSDFCommon::FuseRay(*this, origin, end, normal);
+            }
+
+            inline void FusePoint(const ofVec2f pos, float dist, float weight)
+            {
+                const int x = (int)pos.x;
+                const int y = (int)pos.y;
+                Block& block = GetOrAllocate(x, y);
+                const int i = GetCellIdx(x, y);
+                TSDFCommon::FuseCell(block.dist[i], block.weight[i], dist, weight);
+            }
+
+            // Only allocated blocks can hold weighted cells, so this visits
+            // the observed part of the map only.
+            inline void ComputeError(arm_slam::World& world, float& classificationError, float& distError)
+            {
+                distError = 0;
+                classificationError = 0;
+                size_t num = 0;
+                size_t numIncorrect = 0;
+                for (size_t b = 0; b < blocks.size(); b++)
+                {
+                    const Block& block = blocks[b];
+                    for (int i = 0; i < BLOCK_CELLS; i++)
+                    {
+                        int x = block.x + (i & BLOCK_MASK);
+                        int y = block.y + (i >> BLOCK_SHIFT);
+                        if (block.weight[i] > 0 && IsValid(x, y))
+                        {
+                            TSDFCommon::AddError(block.dist[i], world.GetDist(x, y), num, numIncorrect, distError);
+                        }
+                    }
+                }
+
+                if (num > 0)
+                {
+                    //distError /= num;
+                    classificationError = (float)numIncorrect / (float)num;
+                }
+            }
+
+            // Rebuilds blockIndex after blocks was replaced wholesale.
+            void RebuildIndex()
+            {
+                blockIndex.clear();
+                for(size_t b = 0; b < blocks.size(); b++)
+                {
+                    blockIndex[GetKey(blocks[b].x, blocks[b].y)] = (int)b;
+                }
+                lastKey = INVALID_KEY;
+                lastBlock = -1;
+            }
+
+            inline size_t GetNumBlocks() const
+            {
+                return blocks.size();
+            }
+
+            inline size_t GetMemoryUsage() const
+            {
+                return blocks.capacity() * sizeof(Block) + blockIndex.size() * (sizeof(uint64_t) + sizeof(int) + 2 * sizeof(void*));
+            }
+
+            float truncation;
+            int width;
+            int height;
+            std::vector<Block> blocks;
+            std::unordered_map<uint64_t, int> blockIndex;
+
+        protected:
+            static const uint64_t INVALID_KEY = ~(uint64_t)0;
+
+            static inline uint64_t GetKey(int x, int y)
+            {
+                return ((uint64_t)(uint32_t)(y >> BLOCK_SHIFT) << 32) | (uint32_t)(x >> BLOCK_SHIFT);
+            }
+
+            static inline int GetCellIdx(int x, int y)
+            {
+                return (x & BLOCK_MASK) + ((y & BLOCK_MASK) << BLOCK_SHIFT);
+            }
+
+            inline const Block* Find(int x, int y) const
+            {
+                std::unordered_map<uint64_t, int>::const_iterator it = blockIndex.find(GetKey(x, y));
+                return it == blockIndex.end() ? 0x0 : &blocks[it->second];
+            }
+
+            // Writers only. Consecutive samples of a ray mostly land in the
+            // same block, so the last block written is cached.
+            inline Block& GetOrAllocate(int x, int y)
+            {
+                const uint64_t key = GetKey(x, y);
+                if(key == lastKey)
+                {
+                    return blocks[lastBlock];
+                }
+                std::unordered_map<uint64_t, int>::const_iterator it = blockIndex.find(key);
+                if(it != blockIndex.end())
+                {
+                    lastKey = key;
+                    lastBlock = it->second;
+                    return blocks[lastBlock];
+                }
+
+                Block block;
+                block.x = (x >> BLOCK_SHIFT) << BLOCK_SHIFT;
+                block.y = (y >> BLOCK_SHIFT) << BLOCK_SHIFT;
+                for(int i = 0; i < BLOCK_CELLS; i++)
+                {
+                    block.dist[i] = truncation;
+                    block.weight[i] = 0.0f;
+                }
+                lastKey = key;
+                lastBlock = (int)blocks.size();
+                blockIndex[lastKey] = lastBlock;
+                blocks.push_back(block);
+                return blocks.back();
+            }
+
+            uint64_t lastKey;
+            int lastBlock;
+    };
+
+}
+
+#endif // SPARSETSDF_H_
@@ -3,7 +3,24 @@
 namespace arm_slam
 {
 
-    TSDF::TSDF()
+    TSDF::TSDF() :
+            truncation(0.0f),
+            width(0),
+            height(0),
+            tilesWide(0),
+            tilesHigh(0),
+            version(0),
+            readOnly(false),
+            vectorizedFusion(true),
+            fusionThreads(1),
+            interpolatedSampling(false),
+            cachedGradients(false),
+            gradientVersion(0),
+            errorWorld(NULL),
+            errorVersion(0),
+            errorNum(0),
+            errorNumIncorrect(0),
+            errorDist(0.0)
     {
         // TODO Auto-generated constructor stub
 
@@ -14,4 +31,226 @@ namespace arm_slam
         // TODO Auto-generated destructor stub
     }
 
+    void TSDF::UpdateGradientField()
+    {
+        const uint32_t upTo = Checkpoint();
+        if (gradientField.size() != cells.size())
+        {
+            gradientField.resize(cells.size());
+            gradientVersion = 0;
+        }
+
+        for (int ty = 0; ty < tilesHigh; ty++)
+        {
+            for (int tx = 0; tx < tilesWide; tx++)
+            {
+                if (!IsTileChanged(tx + ty * tilesWide, gradientVersion, upTo))
+                {
+                    continue;
+                }
+
+                // Central differences reach one cell into the neighbouring
+                // tiles.
+                const int x0 = std::max((tx << TILE_SHIFT) - 1, 0);
+                const int y0 = std::max((ty << TILE_SHIFT) - 1, 0);
+                const int x1 = std::min(((tx + 1) << TILE_SHIFT) + 1, width);
+                const int y1 = std::min(((ty + 1) << TILE_SHIFT) + 1, height);
+                for (int y = y0; y < y1; y++)
+                {
+                    for (int x = x0; x < x1; x++)
+                    {
+                        GradientCell& cell = gradientField[GetIdx(x, y)];
+                        cell.trusted = GetDistGradient(x, y, cell.dist, cell.grad);
+                        if (!cell.trusted)
+                        {
+                            cell.dist = GetDist(x, y);
+                            cell.grad = ofVec2f(0, 0);
+                        }
+                    }
+                }
+            }
+        }
+        gradientVersion = upTo;
+    }
+
+    void TSDF::UpdateError(World& world, float& classificationError, float& distError)
+    {
+        const uint32_t upTo = Checkpoint();
+        if (errorWorld != &world || tileErrors.size() != tileVersions.size())
+        {
+            TileError empty = {0, 0, 0.0};
+            tileErrors.assign(tileVersions.size(), empty);
+            errorWorld = &world;
+            errorVersion = 0;
+            errorNum = 0;
+            errorNumIncorrect = 0;
+            errorDist = 0.0;
+        }
+
+        for (int ty = 0; ty < tilesHigh; ty++)
+        {
+            for (int tx = 0; tx < tilesWide; tx++)
+            {
+                const int t = tx + ty * tilesWide;
+                if (!IsTileChanged(t, errorVersion, upTo))
+                {
+                    continue;
+                }
+
+                const TileError tile = ComputeTileError(world, tx, ty);
+                errorNum = errorNum - tileErrors[t].num + tile.num;
+                errorNumIncorrect = errorNumIncorrect - tileErrors[t].numIncorrect + tile.numIncorrect;
+                errorDist += tile.distError - tileErrors[t].distError;
+                tileErrors[t] = tile;
+            }
+        }
+        errorVersion = upTo;
+
+        distError = (float)errorDist;
+        classificationError = errorNum > 0 ? (float)errorNumIncorrect / (float)errorNum : 0.0f;
+    }
+
+    TSDF::TileError TSDF::ComputeTileError(World& world, int tx, int ty)
+    {
+        TileError tile = {0, 0, 0.0};
+        const int x0 = tx << TILE_SHIFT;
+        const int x1 = std::min(x0 + TILE_SIZE, width);
+        const int y1 = std::min((ty + 1) << TILE_SHIFT, height);
+        for (int y = ty << TILE_SHIFT; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                const Cell& cell = cells[GetIdx(x, y)];
+                if (cell.weight > 0)
+                {
+                    const float wDist = world.GetDist(x, y);
+                    const double e = cell.dist - wDist;
+                    tile.num++;
+                    tile.distError += e * e;
+                    if ((cell.dist < 0) != (wDist < 0))
+                    {
+                        tile.numIncorrect++;
+                    }
+                }
+            }
+        }
+        return tile;
+    }
+
+    void TSDF::MakeRays(const ofVec2f& origin, const float& rotation, const std::vector<ofVec2f>& points, const std::vector<ofVec2f>& gradients)
+    {
+        rays.resize(points.size());
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            rays[i] = MakeRay(origin, points.at(i).getRotatedRad(-rotation) + origin, gradients.at(i).normalized());
+        }
+    }
+
+    TSDF::Ray TSDF::MakeRay(const ofVec2f& origin, const ofVec2f& end, const ofVec2f& normal)
+    {
+        Ray ray;
+        ray.end = end;
+        ray.dir = (end - origin);
+        ray.dir.normalize();
+        ray.dot = ray.dir.dot(normal);
+        const float reach = fabs(ray.dir.y) * (truncation + 1.0f) + 1.0f;
+        ray.rowBegin = std::max(0, (int)floor(end.y - reach));
+        ray.rowEnd = std::min(height, (int)ceil(end.y + reach) + 1);
+        return ray;
+    }
+
+    void TSDF::FuseRayBand(const Ray& ray, int rowBegin, int rowEnd, Band& scratch)
+    {
+        const ofVec2f& end = ray.end;
+        const ofVec2f& r = ray.dir;
+        const float dot = ray.dot;
+        const float eps = truncation * 0.25f;
+        const float invFalloff = 1.0f / (truncation - eps);
+        const int n = (int)ceilf(2.0f * truncation);
+        scratch.idx.resize(n + 8);
+        scratch.tile.resize(n + 8);
+        scratch.dist.resize(n + 8);
+        scratch.weight.resize(n + 8);
+        int* bandIdx = &scratch.idx[0];
+        int* bandTile = &scratch.tile[0];
+        float* bandDist = &scratch.dist[0];
+        float* bandWeight = &scratch.weight[0];
+
+        int i = 0;
+#ifdef __AVX__
+        const __m256 lane = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+        const __m256 endX = _mm256_set1_ps(end.x);
+        const __m256 endY = _mm256_set1_ps(end.y);
+        const __m256 rX = _mm256_set1_ps(r.x);
+        const __m256 rY = _mm256_set1_ps(r.y);
+        const __m256 dotV = _mm256_set1_ps(dot);
+        const __m256 epsV = _mm256_set1_ps(eps);
+        const __m256 truncV = _mm256_set1_ps(truncation);
+        const __m256 invFalloffV = _mm256_set1_ps(invFalloff);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 tenth = _mm256_set1_ps(0.1f);
+        const __m128i widthV = _mm_set1_epi32(width);
+        const __m128i tilesWideV = _mm_set1_epi32(tilesWide);
+        const __m128i rowMinV = _mm_set1_epi32(rowBegin - 1);
+        const __m128i rowEndV = _mm_set1_epi32(rowEnd);
+        const __m128i invalid = _mm_set1_epi32(-1);
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m256 t = _mm256_add_ps(_mm256_set1_ps(-truncation + i), lane);
+            const __m256 px = _mm256_sub_ps(endX, _mm256_mul_ps(rX, t));
+            const __m256 py = _mm256_sub_ps(endY, _mm256_mul_ps(rY, t));
+            const __m256i ix = _mm256_cvttps_epi32(px);
+            const __m256i iy = _mm256_cvttps_epi32(py);
+            const __m256 sd = _mm256_mul_ps(t, dotV);
+            const __m256 falloff = _mm256_mul_ps(_mm256_sub_ps(truncV, sd), invFalloffV);
+            const __m256 w = _mm256_mul_ps(_mm256_blendv_ps(falloff, one, _mm256_cmp_ps(sd, epsV, _CMP_LT_OQ)), tenth);
+            _mm256_storeu_ps(&bandDist[i], sd);
+            _mm256_storeu_ps(&bandWeight[i], w);
+
+            // AVX has no 256 bit integer compares, so finish the
+            // indices in two SSE halves.
+            for (int half = 0; half < 2; half++)
+            {
+                const __m128i x = half ? _mm256_extractf128_si256(ix, 1) : _mm256_castsi256_si128(ix);
+                const __m128i y = half ? _mm256_extractf128_si256(iy, 1) : _mm256_castsi256_si128(iy);
+                const __m128i valid = _mm_and_si128(
+                        _mm_and_si128(_mm_cmpgt_epi32(x, invalid), _mm_cmplt_epi32(x, widthV)),
+                        _mm_and_si128(_mm_cmpgt_epi32(y, rowMinV), _mm_cmplt_epi32(y, rowEndV)));
+                const __m128i idx = _mm_add_epi32(x, _mm_mullo_epi32(y, widthV));
+                const __m128i tile = _mm_add_epi32(_mm_srai_epi32(x, TILE_SHIFT), _mm_mullo_epi32(_mm_srai_epi32(y, TILE_SHIFT), tilesWideV));
+                _mm_storeu_si128((__m128i*)&bandIdx[i + 4 * half], _mm_blendv_epi8(invalid, idx, valid));
+                _mm_storeu_si128((__m128i*)&bandTile[i + 4 * half], tile);
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            const float t = -truncation + i;
+            const ofVec2f p = end - r * t;
+            const int x = (int)p.x;
+            const int y = (int)p.y;
+            const float sd = t * dot;
+            bandIdx[i] = IsValid(x, y) && y >= rowBegin && y < rowEnd ? GetIdx(x, y) : -1;
+            bandTile[i] = bandIdx[i] < 0 ? 0 : GetTileIdx(x, y);
+            bandDist[i] = sd;
+            bandWeight[i] = (sd < eps ? 1.0f : (truncation - sd) * invFalloff) * 0.1f;
+        }
+
+        Cell* grid = &cells[0];
+        uint32_t* stamps = &tileVersions[0];
+        for (i = 0; i < n; i++)
+        {
+            const int idx = bandIdx[i];
+            if (idx < 0)
+            {
+                continue;
+            }
+            Cell& cell = grid[idx];
+            const float w = bandWeight[i];
+            cell.dist = (cell.weight * cell.dist + w * bandDist[i]) / (w + cell.weight);
+            cell.weight += w;
+            stamps[bandTile[i]] = version;
+        }
+    }
+
 }
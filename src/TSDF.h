@@ -2,14 +2,51 @@
 #define TSDF_H_
 
 #include <vector>
+#include <memory>
+#include <stdint.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 #include "ofMain.h"
 #include "World.h"
+#include "ThreadPool.h"
+#include "TSDFCommon.h"
 namespace arm_slam
 {
 
     class TSDF
     {
         public:
+            static const int TILE_SHIFT = 4;
+            static const int TILE_SIZE = 1 << TILE_SHIFT;
+            static const int TILE_MASK = TILE_SIZE - 1;
+
+            // Distance and weight are interleaved so fusing a cell touches a
+            // single cache line.
+            struct Cell
+            {
+                    float dist;
+                    float weight;
+            };
+
+            // Distance and central difference gradient of a cell, cached
+            // for interpolated sampling.
+            struct GradientCell
+            {
+                    float dist;
+                    ofVec2f grad;
+                    bool trusted;
+            };
+
+            // Squared distance error and misclassified cells of the
+            // weighted cells of one tile; see UpdateError.
+            struct TileError
+            {
+                    uint32_t num;
+                    uint32_t numIncorrect;
+                    double distError;
+            };
+
             TSDF();
             virtual ~TSDF();
 
@@ -18,8 +55,17 @@ namespace arm_slam
                 width = w;
                 height = h;
                 truncation = t;
-                dist.resize(width * height, truncation);
-                weight.resize(width * height, 0);
+                Cell empty;
+                empty.dist = truncation;
+                empty.weight = 0.0f;
+                cells.resize(width * height, empty);
+                tilesWide = (width + TILE_MASK) >> TILE_SHIFT;
+                tilesHigh = (height + TILE_MASK) >> TILE_SHIFT;
+                version++;
+                tileVersions.assign(tilesWide * tilesHigh, version);
+                gradientField.clear();
+                tileErrors.clear();
+                errorWorld = NULL;
             }
 
             void Initialize(World& world, float t)
@@ -30,66 +76,74 @@ namespace arm_slam
                 {
                     for(int y = 0; y < height; y++)
                     {
-                        dist[GetIdx(x, y)] = t;
-                        weight[GetIdx(x, y)] = 0.0f;
+                        cells[GetIdx(x, y)].dist = t;
+                        cells[GetIdx(x, y)].weight = 0.0f;
                     }
                 }
             }
 
             void SetColors(ofImage* img)
             {
-                ofColor color;
                 for(int x = 0; x < width; x++)
                 {
                     for(int y = 0; y < height; y++)
                     {
-                        float d = dist[GetIdx(x, y)];
-                        float w = weight[GetIdx(x, y)];
-
-                        if(fabs(d) > 2)
-                        {
-                        color.setHue((d + truncation) / truncation * 64.0f);
-                        color.setSaturation(255.0f);
-                        color.setBrightness(255.0f);
-                        }
-                        else
-                        {
-                            color.r = 10;
-                            color.g = 25;
-                            color.b = 25;
-                        }
-                        color.a = w > 1e-5 ? 200 : 0;
-                        img->setColor(x, y, color);
+                        const Cell& cell = cells[GetIdx(x, y)];
+                        img->setColor(x, y, TSDFCommon::GetColor(cell.dist, cell.weight, truncation));
                     }
                 }
                 img->update();
             }
 
-            inline int GetIdx(int x, int y)
+            inline int GetIdx(int x, int y) const
             {
                 return x + y * width;
             }
 
-            inline bool IsValid(int x, int y)
+            inline int GetTileIdx(int x, int y) const
+            {
+                return (x >> TILE_SHIFT) + (y >> TILE_SHIFT) * tilesWide;
+            }
+
+            // Closes the current version and returns it. Every cell written
+            // after this call lands in a tile stamped with a later version,
+            // so a consumer that remembers the value it got last time can
+            // find the tiles changed since with IsTileChanged. A readOnly
+            // copy is never written, so it just returns its version.
+            inline uint32_t Checkpoint()
+            {
+                return readOnly ? version : version++;
+            }
+
+            // True if tile t was written after the checkpoint that returned
+            // since and no later than the one that returned upTo.
+            inline bool IsTileChanged(int t, uint32_t since, uint32_t upTo) const
+            {
+                return tileVersions[t] > since && tileVersions[t] <= upTo;
+            }
+
+            inline bool IsValid(int x, int y) const
             {
                 return x >= 0 && x < width && y >= 0 && y < height;
             }
 
             inline void SetWeight(int x, int y, float value)
             {
-                weight[GetIdx(x, y)] = value;
+                cells[GetIdx(x, y)].weight = value;
+                tileVersions[GetTileIdx(x, y)] = version;
             }
 
             inline void SetDist(int x, int y, float value)
             {
-                dist[GetIdx(x, y)] = value;
+                cells[GetIdx(x, y)].dist = value;
+                tileVersions[GetTileIdx(x, y)] = version;
             }
 
-            inline float GetWeight(int x, int y)
+            inline float GetWeight(int x, int y) const
             {
                 if (IsValid(x, y))
                 {
-                    return weight[GetIdx(x, y)];
+                    return cells[GetIdx(x, y)].weight;
                 }
                 else
                 {
@@ -97,11 +151,11 @@ namespace arm_slam
                 }
             }
 
-            inline float GetDist(int x, int y)
+            inline float GetDist(int x, int y) const
             {
                 if (IsValid(x, y))
                 {
-                    return dist[GetIdx(x, y)];
+                    return cells[GetIdx(x, y)].dist;
                 }
                 else
                 {
@@ -114,63 +168,267 @@ namespace arm_slam
                return x > 0.0 ? 1.0f : -1.0f;
             }
 
-            inline ofVec2f GetGradient(int x, int y)
+            inline ofVec2f GetGradient(int x, int y) const
+            {
+                return TSDFCommon::GetGradient(*this, x, y);
+            }
+
+            // Distance at (x, y) and its central difference gradient. Returns
+            // false, like GetGradient returns zero, where a neighbour has
+            // too little weight to trust.
+            inline bool GetDistGradient(int x, int y, float& d, ofVec2f& grad) const
             {
-                float d0 = GetDist(x, y);
-                float dxplus = GetDist(x + 1, y);
-                float dyplus = GetDist(x, y + 1);
-                float wxplus = GetWeight(x + 1, y);
-                float wyplus = GetWeight(x, y + 1);
-                float dxminus = GetDist(x - 1, y);
-                float dyminus = GetDist(x, y - 1);
-                float wxminus = GetWeight(x - 1, y);
-                float wyminus = GetWeight(x, y - 1);
+                return TSDFCommon::GetDistGradient(*this, x, y, d, grad);
+            }
+
+            // Distance and gradient at a point in cell units, where cell
+            // (i, j) covers [i, i + 1) x [j, j + 1). Without
+            // interpolatedSampling this is GetDistGradient of the cell
+            // containing the point. With it, the distance is interpolated
+            // bilinearly between the four nearest cell centres, and so is
+            // the cached central difference gradient if cachedGradients is
+            // set; otherwise the gradient is the exact gradient of the
+            // interpolated distance. Returns false unless all four cells
+            // are trusted.
+            inline bool SampleDistGradient(float x, float y, float& d, ofVec2f& grad)
+            {
+                if (!interpolatedSampling)
+                {
+                    return GetDistGradient((int)x, (int)y, d, grad);
+                }
+
+                const float fx = x - 0.5f;
+                const float fy = y - 0.5f;
+                const float x0 = floorf(fx);
+                const float y0 = floorf(fy);
+                const int i = (int)x0;
+                const int j = (int)y0;
+                if (i < 0 || j < 0 || i + 1 >= width || j + 1 >= height)
+                {
+                    return false;
+                }
+                const float tx = fx - x0;
+                const float ty = fy - y0;
+                const int idx = GetIdx(i, j);
+
+                if (cachedGradients)
+                {
+                    if (gradientField.size() != cells.size())
+                    {
+                        return false;
+                    }
+                    const GradientCell& g00 = gradientField[idx];
+                    const GradientCell& g10 = gradientField[idx + 1];
+                    const GradientCell& g01 = gradientField[idx + width];
+                    const GradientCell& g11 = gradientField[idx + width + 1];
+                    if (!(g00.trusted && g10.trusted && g01.trusted && g11.trusted))
+                    {
+                        return false;
+                    }
+                    const float w00 = (1.0f - tx) * (1.0f - ty);
+                    const float w10 = tx * (1.0f - ty);
+                    const float w01 = (1.0f - tx) * ty;
+                    const float w11 = tx * ty;
+                    d = w00 * g00.dist + w10 * g10.dist + w01 * g01.dist + w11 * g11.dist;
+                    grad = g00.grad * w00 + g10.grad * w10 + g01.grad * w01 + g11.grad * w11;
+                    return true;
+                }
+
+                const Cell& c00 = cells[idx];
+                const Cell& c10 = cells[idx + 1];
+                const Cell& c01 = cells[idx + width];
+                const Cell& c11 = cells[idx + width + 1];
+                if (!(c00.weight > 2 && c10.weight > 2 && c01.weight > 2 && c11.weight > 2))
+                {
+                    return false;
+                }
+                const float top = c00.dist + tx * (c10.dist - c00.dist);
+                const float bottom = c01.dist + tx * (c11.dist - c01.dist);
+                d = top + ty * (bottom - top);
+                grad.x = (1.0f - ty) * (c10.dist - c00.dist) + ty * (c11.dist - c01.dist);
+                grad.y = bottom - top;
+                return true;
+            }
+
+            // Whether Sample* interpolate rather than read the cell
+            // containing the point. Trackers check it once per pass, so
+            // their per point loops don't branch on it.
+            inline bool IsSamplingInterpolated() const
+            {
+                return interpolatedSampling;
+            }
 
-                if(wxplus > 2 && wyplus > 2 && wyminus > 2 && wxminus > 2)
+            // SampleDistGradient scaled by the distance, like GetGradient.
+            inline ofVec2f SampleGradient(float x, float y)
+            {
+                if (!interpolatedSampling)
                 {
-                    return ofVec2f((dxplus - dxminus) * 0.5f, (dyplus - dyminus) * 0.5f) * d0;
+                    return GetGradient((int)x, (int)y);
+                }
+
+                float d;
+                ofVec2f grad;
+                if (SampleDistGradient(x, y, d, grad))
+                {
+                    return grad * d;
                 }
                 return ofVec2f(0, 0);
             }
 
+            // Recomputes the cached gradient of every cell in or next to a
+            // tile written since the last call. FuseRayCloud calls it when
+            // cachedGradients is set; other writers must call it themselves.
+            void UpdateGradientField();
+
             inline void FuseRayCloud(const ofVec2f& origin, const float& rotation, const std::vector<ofVec2f>& points, const std::vector<ofVec2f>& gradients)
             {
-                for (size_t i =0; i < points.size(); i++)
+                if (fusionThreads != 1)
+                {
+                    FuseRayCloudParallel(origin, rotation, points, gradients, fusionThreads);
+                }
+                else if (vectorizedFusion)
+                {
+                    MakeRays(origin, rotation, points, gradients);
+                    for (size_t i = 0; i < rays.size(); i++)
+                    {
+                        FuseRayBand(rays[i], 0, height, band);
+                    }
+                }
+                else
+                {
+                    TSDFCommon::FuseRayCloud(*this, origin, rotation, points, gradients);
+                }
+
+                if (interpolatedSampling && cachedGradients)
                 {
-                    FuseRay(origin, points.at(i).getRotatedRad(-rotation) + origin, gradients.at(i).normalized());
+                    UpdateGradientField();
                 }
             }
 
-            inline float GetWeight(float t)
+            inline float GetWeight(float t) const
             {
-                float eps = truncation * 0.25f;
-                return t < eps ? 1.0f : (truncation - t) / (truncation - eps);
+                return TSDFCommon::GetFusionWeight(truncation, t);
             }
 
             inline void FuseRay(const ofVec2f& origin, const ofVec2f& end, const ofVec2f& normal)
             {
-                ofVec2f p = origin;
-                ofVec2f r = (end - origin);
-                r.normalize();
-                float dot = r.dot(normal);
-                for (float t = -truncation; t < truncation; t++)
+                TSDFCommon::FuseRay(*this, origin, end, normal);
+            }
+
+            // A ray set up for fusion: unit direction, the cosine between it
+            // and the surface normal, and the rows its band can touch.
+            struct Ray
+            {
+                    ofVec2f end;
+                    ofVec2f dir;
+                    float dot;
+                    int rowBegin;
+                    int rowEnd;
+            };
+
+            // Per-thread scratch for FuseRayBand.
+            struct Band
+            {
+                    std::vector<int> idx;
+                    std::vector<int> tile;
+                    std::vector<float> dist;
+                    std::vector<float> weight;
+            };
+
+            // Same samples as FuseRay. Cell indices, signed distances and
+            // weights for the whole truncation band are computed eight at a
+            // time, then the band is fused in order so repeated cells see the
+            // same sequence of updates. Matches FuseRay up to float rounding.
+            inline void FuseRayVectorized(const ofVec2f& origin, const ofVec2f& end, const ofVec2f& normal)
+            {
+                FuseRayBand(MakeRay(origin, end, normal), 0, height, band);
+            }
+
+            // Fuses a ray cloud on numThreads threads (0 uses every core)
+            // without locks. The grid is cut into horizontal strips and each
+            // strip is owned by one thread, which fuses, in ray order, the
+            // samples of the rays crossing it that land in its rows. Every
+            // cell therefore sees exactly the update sequence of the serial
+            // vectorized loop, and both run the one out of line FuseRayBand,
+            // so the result is identical to it for any thread count.
+            inline void FuseRayCloudParallel(const ofVec2f& origin, const float& rotation, const std::vector<ofVec2f>& points, const std::vector<ofVec2f>& gradients, size_t numThreads)
+            {
+                if (numThreads == 0)
                 {
-                    p = end - r * t;
+                    numThreads = ThreadPool::GetHardwareThreads();
+                }
+                // A thread needs at least one strip of work.
+                numThreads = std::min(numThreads, (size_t)std::max(1, (height + TILE_MASK) >> TILE_SHIFT));
+                // Strips are whole tile rows so no two threads stamp the
+                // same tile.
+                const int stripRows = std::max(TILE_SIZE, (height / (int)(numThreads * 4)) & ~TILE_MASK);
+                const int numStrips = (height + stripRows - 1) / stripRows;
+                MakeRays(origin, rotation, points, gradients);
+                stripRays.resize(numStrips);
+                for (int s = 0; s < numStrips; s++)
+                {
+                    stripRays[s].clear();
+                }
 
-                    if(IsValid((int)p.x, (int)p.y))
+                for (size_t i = 0; i < rays.size(); i++)
+                {
+                    for (int s = rays[i].rowBegin / stripRows; s * stripRows < rays[i].rowEnd; s++)
                     {
-                        FusePoint(p, t * dot, GetWeight(t * dot) * 0.1f);
+                        stripRays[s].push_back(i);
                     }
                 }
+
+                if (stripBands.size() < numThreads)
+                {
+                    stripBands.resize(numThreads);
+                }
+                // One chunk of strips per thread, each with its own scratch.
+                const auto fuseStrips = [&, stripRows](size_t chunk, size_t begin, size_t end)
+                {
+                    Band& scratch = stripBands[chunk];
+                    for (size_t s = begin; s < end; s++)
+                    {
+                        const int rowBegin = s * stripRows;
+                        const int rowEnd = std::min(height, rowBegin + stripRows);
+                        for (size_t k = 0; k < stripRays[s].size(); k++)
+                        {
+                            FuseRayBand(rays[stripRays[s][k]], rowBegin, rowEnd, scratch);
+                        }
+                    }
+                };
+
+                if (numThreads == 1)
+                {
+                    fuseStrips(0, 0, numStrips);
+                    return;
+                }
+                // The calling thread takes a chunk itself.
+                if (!fusionPool || fusionPool->GetNumThreads() != numThreads - 1)
+                {
+                    fusionPool = std::make_shared<ThreadPool>(numThreads - 1);
+                }
+                ParallelFor(*fusionPool, 0, numStrips, numThreads, fuseStrips);
             }
 
+            // Sets up rays for a scan taken at origin, rotation.
+            void MakeRays(const ofVec2f& origin, const float& rotation, const std::vector<ofVec2f>& points, const std::vector<ofVec2f>& gradients);
+
+            // Rows are clamped to the map; rowBegin >= rowEnd if the band
+            // misses it entirely.
+            Ray MakeRay(const ofVec2f& origin, const ofVec2f& end, const ofVec2f& normal);
+
+            // FuseRayVectorized restricted to samples in rows
+            // [rowBegin, rowEnd). Out of line so the serial and parallel
+            // paths run the same code and round identically.
+            void FuseRayBand(const Ray& ray, int rowBegin, int rowEnd, Band& scratch);
+
             inline void FusePoint(const ofVec2f pos, float dist, float weight)
             {
-                float oldSDF = GetDist((int)pos.x, (int)pos.y);
-                float oldWeight = GetWeight((int)pos.x, (int)pos.y);
-                float newDist = (oldWeight * oldSDF + weight * dist) / (weight + oldWeight);
-                SetDist((int)pos.x, (int)pos.y, newDist);
-                SetWeight((int)pos.x, (int)pos.y, oldWeight + weight);
+                const int x = (int)pos.x;
+                const int y = (int)pos.y;
+                Cell& cell = cells[GetIdx(x, y)];
+                TSDFCommon::FuseCell(cell.dist, cell.weight, dist, weight);
+                tileVersions[GetTileIdx(x, y)] = version;
             }
 
             inline void ComputeError(arm_slam::World& world, float& classificationError, float& distError)
@@ -183,22 +441,10 @@ namespace arm_slam
                 {
                     for (int y = 0; y < height; y++)
                     {
-                        float weight = GetWeight(x, y);
-
-                        if (weight > 0)
+                        const Cell& cell = cells[GetIdx(x, y)];
+                        if (cell.weight > 0)
                         {
-                            num++;
-                            float dist = GetDist(x, y);
-                            float wDist = world.GetDist(x, y);
-
-                            bool myClass = dist < 0;
-                            bool worldClass = wDist < 0;
-                            distError += pow(dist - wDist, 2);
-
-                            if (myClass != worldClass)
-                            {
-                                numIncorrect++;
-                            }
+                            TSDFCommon::AddError(cell.dist, world.GetDist(x, y), num, numIncorrect, distError);
                         }
                     }
                 }
@@ -210,11 +456,58 @@ namespace arm_slam
                 }
             }
 
+            // ComputeError kept up to date incrementally: each call rescans
+            // only the tiles written since the last one, replacing their
+            // old contribution to running totals, so it costs O(changed
+            // tiles) rather than a pass over the whole map. Matches
+            // ComputeError up to float rounding, since the squared error is
+            // summed in double. Calling it with another world starts over.
+            void UpdateError(World& world, float& classificationError, float& distError);
+
             float truncation;
-            std::vector<float> dist;
-            std::vector<float> weight;
+            std::vector<Cell> cells;
             int width;
             int height;
+            int tilesWide;
+            int tilesHigh;
+            // Current version; see Checkpoint.
+            uint32_t version;
+            // Version of the last write to each TILE_SIZE x TILE_SIZE tile.
+            std::vector<uint32_t> tileVersions;
+            // Set on copies that carry the version and tile versions of the
+            // map they were copied from, like AsyncMapper snapshots, so
+            // consumers can move from the map to its copies and back.
+            bool readOnly;
+            // Fuse with FuseRayVectorized instead of FuseRay.
+            bool vectorizedFusion;
+            // Threads used by FuseRayCloud; anything but 1 fuses through
+            // FuseRayCloudParallel, 0 uses every core.
+            size_t fusionThreads;
+            // See SampleDistGradient.
+            bool interpolatedSampling;
+            bool cachedGradients;
+            std::vector<GradientCell> gradientField;
+            // Version up to which gradientField is current.
+            uint32_t gradientVersion;
+            // Per tile terms and totals of UpdateError, current up to
+            // errorVersion against errorWorld.
+            std::vector<TileError> tileErrors;
+            World* errorWorld;
+            uint32_t errorVersion;
+            uint64_t errorNum;
+            uint64_t errorNumIncorrect;
+            double errorDist;
+
+        protected:
+            TileError ComputeTileError(World& world, int tx, int ty);
+
+            Band band;
+            std::vector<Band> stripBands;
+            std::vector<Ray> rays;
+            std::vector<std::vector<size_t> > stripRays;
+            // Workers of FuseRayCloudParallel, kept across calls. Copies of
+            // the map share it.
+            std::shared_ptr<ThreadPool> fusionPool;
 
     };
 
@@ -0,0 +1,21 @@
+#include "TSDFColorizer.h"
+
+namespace arm_slam
+{
+
+    TSDFColorizer::TSDFColorizer() :
+            lastVersion(0),
+            lutTruncation(-1.0f),
+            lutScale(0.0f),
+            surface(0),
+            transparent(0)
+    {
+
+    }
+
+    TSDFColorizer::~TSDFColorizer()
+    {
+
+    }
+
+}
@@ -0,0 +1,163 @@
+#ifndef TSDFCOLORIZER_H_
+#define TSDFCOLORIZER_H_
+
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include "ofMain.h"
+#include "TSDF.h"
+
+namespace arm_slam
+{
+    // Keeps an RGBA image of a TSDF up to date incrementally. Only tiles the
+    // TSDF stamped since the last Update are recolored, through a colormap
+    // lookup table, and only runs of changed tiles are uploaded to the
+    // texture. Produces the same colors as TSDF::SetColors up to the hue
+    // quantization of the table.
+    class TSDFColorizer
+    {
+        public:
+            static const int LUT_SIZE = 1024;
+
+            TSDFColorizer();
+            virtual ~TSDFColorizer();
+
+            // Forces a full repaint on the next Update.
+            void Reset()
+            {
+                lastVersion = 0;
+                lutTruncation = -1.0f;
+            }
+
+            // img must be allocated as OF_IMAGE_COLOR_ALPHA with the size of
+            // the TSDF. Returns the number of tiles repainted.
+            size_t Update(TSDF& tsdf, ofImage& img)
+            {
+                if (tsdf.truncation != lutTruncation)
+                {
+                    BuildLUT(tsdf.truncation);
+                    lastVersion = 0;
+                }
+
+                const uint32_t upTo = tsdf.Checkpoint();
+                unsigned char* pixels = img.getPixels().getData();
+                const bool upload = img.isUsingTexture() && img.getTexture().isAllocated();
+                if (upload)
+                {
+                    glBindTexture(img.getTexture().texData.textureTarget, img.getTexture().texData.textureID);
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, tsdf.width);
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                }
+
+                size_t numChanged = 0;
+                for (int ty = 0; ty < tsdf.tilesHigh; ty++)
+                {
+                    const int y0 = ty << TSDF::TILE_SHIFT;
+                    const int y1 = std::min(y0 + TSDF::TILE_SIZE, tsdf.height);
+                    int tx = 0;
+                    while (tx < tsdf.tilesWide)
+                    {
+                        if (!tsdf.IsTileChanged(tx + ty * tsdf.tilesWide, lastVersion, upTo))
+                        {
+                            tx++;
+                            continue;
+                        }
+
+                        const int runBegin = tx;
+                        while (tx < tsdf.tilesWide && tsdf.IsTileChanged(tx + ty * tsdf.tilesWide, lastVersion, upTo))
+                        {
+                            tx++;
+                        }
+                        numChanged += tx - runBegin;
+
+                        const int x0 = runBegin << TSDF::TILE_SHIFT;
+                        const int x1 = std::min(tx << TSDF::TILE_SHIFT, tsdf.width);
+                        for (int y = y0; y < y1; y++)
+                        {
+                            const TSDF::Cell* cell = &tsdf.cells[tsdf.GetIdx(x0, y)];
+                            uint32_t* out = (uint32_t*)(pixels + 4 * (x0 + y * tsdf.width));
+                            for (int x = x0; x < x1; x++)
+                            {
+                                *out++ = GetColor(cell->dist, cell->weight);
+                                cell++;
+                            }
+                        }
+
+                        if (upload)
+                        {
+                            glTexSubImage2D(img.getTexture().texData.textureTarget, 0, x0, y0, x1 - x0, y1 - y0,
+                                    GL_RGBA, GL_UNSIGNED_BYTE, pixels + 4 * (x0 + y0 * tsdf.width));
+                        }
+                    }
+                }
+
+                if (upload)
+                {
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                    glBindTexture(img.getTexture().texData.textureTarget, 0);
+                }
+
+                lastVersion = upTo;
+                return numChanged;
+            }
+
+            // Packed RGBA, in memory order, of a cell.
+            inline uint32_t GetColor(float d, float w) const
+            {
+                if (w <= 1e-5)
+                {
+                    return transparent;
+                }
+                if (fabs(d) <= 2)
+                {
+                    return surface;
+                }
+                int i = (int)((d + lutTruncation) * lutScale);
+                i = i < 0 ? 0 : (i >= LUT_SIZE ? LUT_SIZE - 1 : i);
+                return lut[i];
+            }
+
+            uint32_t lastVersion;
+
+        protected:
+            void BuildLUT(float truncation)
+            {
+                lutTruncation = truncation;
+                lutScale = LUT_SIZE / (2.0f * truncation);
+                lut.resize(LUT_SIZE);
+                ofColor color;
+                for (int i = 0; i < LUT_SIZE; i++)
+                {
+                    float d = (i + 0.5f) / lutScale - truncation;
+                    color.setHue((d + truncation) / truncation * 64.0f);
+                    color.setSaturation(255.0f);
+                    color.setBrightness(255.0f);
+                    color.a = 200;
+                    lut[i] = Pack(color);
+                }
+
+                color.r = 10;
+                color.g = 25;
+                color.b = 25;
+                color.a = 200;
+                surface = Pack(color);
+                transparent = 0;
+            }
+
+            static inline uint32_t Pack(const ofColor& color)
+            {
+                unsigned char bytes[4] = {color.r, color.g, color.b, color.a};
+                uint32_t packed;
+                memcpy(&packed, bytes, sizeof(packed));
+                return packed;
+            }
+
+            std::vector<uint32_t> lut;
+            float lutTruncation;
+            float lutScale;
+            uint32_t surface;
+            uint32_t transparent;
+    };
+}
+
+#endif // TSDFCOLORIZER_H_
@@ -0,0 +1,123 @@
+#ifndef TSDFCOMMON_H_
+#define TSDFCOMMON_H_
+
+#include <vector>
+#include <cmath>
+#include "ofMain.h"
+
+namespace arm_slam
+{
+    // Fusion, sampling and error logic shared by TSDF and SparseTSDF, so the
+    // two maps can't drift apart. Each map only stores cells: the templates
+    // here go through its const IsValid, GetDist and GetWeight accessors,
+    // its truncation, and its FusePoint, which applies FuseCell to a cell.
+    class TSDFCommon
+    {
+        public:
+            // Colour SetColors paints a cell with.
+            static inline ofColor GetColor(float d, float w, float truncation)
+            {
+                ofColor color;
+                if(fabs(d) > 2)
+                {
+                    color.setHue((d + truncation) / truncation * 64.0f);
+                    color.setSaturation(255.0f);
+                    color.setBrightness(255.0f);
+                }
+                else
+                {
+                    color.r = 10;
+                    color.g = 25;
+                    color.b = 25;
+                }
+                color.a = w > 1e-5 ? 200 : 0;
+                return color;
+            }
+
+            template <typename Map> static inline ofVec2f GetGradient(const Map& map, int x, int y)
+            {
+                float d0 = map.GetDist(x, y);
+                float dxplus = map.GetDist(x + 1, y);
+                float dyplus = map.GetDist(x, y + 1);
+                float wxplus = map.GetWeight(x + 1, y);
+                float wyplus = map.GetWeight(x, y + 1);
+                float dxminus = map.GetDist(x - 1, y);
+                float dyminus = map.GetDist(x, y - 1);
+                float wxminus = map.GetWeight(x - 1, y);
+                float wyminus = map.GetWeight(x, y - 1);
+
+                if(wxplus > 2 && wyplus > 2 && wyminus > 2 && wxminus > 2)
+                {
+                    return ofVec2f((dxplus - dxminus) * 0.5f, (dyplus - dyminus) * 0.5f) * d0;
+                }
+                return ofVec2f(0, 0);
+            }
+
+            template <typename Map> static inline bool GetDistGradient(const Map& map, int x, int y, float& d, ofVec2f& grad)
+            {
+                if(map.GetWeight(x + 1, y) > 2 && map.GetWeight(x, y + 1) > 2 && map.GetWeight(x, y - 1) > 2 && map.GetWeight(x - 1, y) > 2)
+                {
+                    d = map.GetDist(x, y);
+                    grad.x = (map.GetDist(x + 1, y) - map.GetDist(x - 1, y)) * 0.5f;
+                    grad.y = (map.GetDist(x, y + 1) - map.GetDist(x, y - 1)) * 0.5f;
+                    return true;
+                }
+                return false;
+            }
+
+            // Weight of a sample t cells in front of the surface.
+            static inline float GetFusionWeight(float truncation, float t)
+            {
+                float eps = truncation * 0.25f;
+                return t < eps ? 1.0f : (truncation - t) / (truncation - eps);
+            }
+
+            // Running weighted average of a cell's distance.
+            static inline void FuseCell(float& cellDist, float& cellWeight, float dist, float weight)
+            {
+                float oldSDF = cellDist;
+                float oldWeight = cellWeight;
+                cellDist = (oldWeight * oldSDF + weight * dist) / (weight + oldWeight);
+                cellWeight = oldWeight + weight;
+            }
+
+            template <typename Map> static inline void FuseRay(Map& map, const ofVec2f& origin, const ofVec2f& end, const ofVec2f& normal)
+            {
+                const float truncation = map.truncation;
+                ofVec2f p = origin;
+                ofVec2f r = (end - origin);
+                r.normalize();
+                float dot = r.dot(normal);
+                for (float t = -truncation; t < truncation; t++)
+                {
+                    p = end - r * t;
+
+                    if(map.IsValid((int)p.x, (int)p.y))
+                    {
+                        map.FusePoint(p, t * dot, GetFusionWeight(truncation, t * dot) * 0.1f);
+                    }
+                }
+            }
+
+            template <typename Map> static inline void FuseRayCloud(Map& map, const ofVec2f& origin, const float& rotation, const std::vector<ofVec2f>& points, const std::vector<ofVec2f>& gradients)
+            {
+                for (size_t i =0; i < points.size(); i++)
+                {
+                    FuseRay(map, origin, points.at(i).getRotatedRad(-rotation) + origin, gradients.at(i).normalized());
+                }
+            }
+
+            // Adds a weighted cell to the ComputeError totals.
+            static inline void AddError(float dist, float wDist, size_t& num, size_t& numIncorrect, float& distError)
+            {
+                num++;
+                distError += pow(dist - wDist, 2);
+                if ((dist < 0) != (wDist < 0))
+                {
+                    numIncorrect++;
+                }
+            }
+    };
+}
+
+#endif // TSDFCOMMON_H_
@@ -0,0 +1,16 @@
+#include "TSDFPyramid.h"
+
+namespace arm_slam
+{
+
+    TSDFPyramid::TSDFPyramid()
+    {
+
+    }
+
+    TSDFPyramid::~TSDFPyramid()
+    {
+
+    }
+
+}
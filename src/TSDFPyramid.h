@@ -0,0 +1,208 @@
+#ifndef TSDFPYRAMID_H_
+#define TSDFPYRAMID_H_
+
+#include <vector>
+#include <stdint.h>
+#include "ofMain.h"
+#include "TSDF.h"
+
+namespace arm_slam
+{
+    // Coarser copies of a TSDF for coarse to fine tracking. Level l has
+    // cells 2^l full resolution cells wide; each cell holds the weighted
+    // mean distance and the mean weight of the four cells below it, so
+    // distances stay in full resolution units. Update only recomputes the
+    // cells under tiles the TSDF stamped since the last Update, level by
+    // level.
+    class TSDFPyramid
+    {
+        public:
+            // A level seen through full resolution coordinates, with the
+            // map interface of TSDF the trackers use.
+            class Level
+            {
+                public:
+                    Level(TSDF& grid_, int shift_) :
+                        grid(&grid_),
+                        shift(shift_),
+                        invSpacing(1.0f / (1 << shift_))
+                    {
+
+                    }
+
+                    inline bool IsValid(int x, int y)
+                    {
+                        return grid->IsValid(x >> shift, y >> shift);
+                    }
+
+                    inline float GetDist(int x, int y)
+                    {
+                        return grid->GetDist(x >> shift, y >> shift);
+                    }
+
+                    inline float GetWeight(int x, int y)
+                    {
+                        return grid->GetWeight(x >> shift, y >> shift);
+                    }
+
+                    // As TSDF::GetGradient, with the central difference taken
+                    // across neighbouring cells of this level.
+                    inline ofVec2f GetGradient(int x, int y)
+                    {
+                        float d;
+                        ofVec2f grad;
+                        if(GetDistGradient(x, y, d, grad))
+                        {
+                            return grad * d;
+                        }
+                        return ofVec2f(0, 0);
+                    }
+
+                    inline bool GetDistGradient(int x, int y, float& d, ofVec2f& grad)
+                    {
+                        const int cx = x >> shift;
+                        const int cy = y >> shift;
+                        if(grid->GetWeight(cx + 1, cy) > 2 && grid->GetWeight(cx, cy + 1) > 2 && grid->GetWeight(cx, cy - 1) > 2 && grid->GetWeight(cx - 1, cy) > 2)
+                        {
+                            d = grid->GetDist(cx, cy);
+                            grad.x = (grid->GetDist(cx + 1, cy) - grid->GetDist(cx - 1, cy)) * 0.5f * invSpacing;
+                            grad.y = (grid->GetDist(cx, cy + 1) - grid->GetDist(cx, cy - 1)) * 0.5f * invSpacing;
+                            return true;
+                        }
+                        return false;
+                    }
+
+                    inline bool SampleDistGradient(float x, float y, float& d, ofVec2f& grad)
+                    {
+                        return GetDistGradient((int)x, (int)y, d, grad);
+                    }
+
+                    inline ofVec2f SampleGradient(float x, float y)
+                    {
+                        return GetGradient((int)x, (int)y);
+                    }
+
+                    inline bool IsSamplingInterpolated() const
+                    {
+                        return false;
+                    }
+
+                    TSDF* grid;
+                    int shift;
+                    float invSpacing;
+            };
+
+            TSDFPyramid();
+            virtual ~TSDFPyramid();
+
+            // Allocates numLevels empty levels below fine. The next Update
+            // fills them from every cell of fine.
+            void Initialize(const TSDF& fine, int numLevels)
+            {
+                levels.resize(numLevels);
+                lastVersions.assign(numLevels, 0);
+                int w = fine.width;
+                int h = fine.height;
+                for(int l = 0; l < numLevels; l++)
+                {
+                    w = (w + 1) >> 1;
+                    h = (h + 1) >> 1;
+                    levels[l].Initialize(w, h, fine.truncation);
+                }
+            }
+
+            inline int GetNumLevels() const
+            {
+                return (int)levels.size();
+            }
+
+            // Level l, counted from 1 for half resolution.
+            inline Level GetLevel(int l)
+            {
+                return Level(levels[l - 1], l);
+            }
+
+            // Returns the number of full resolution tiles recomputed.
+            size_t Update(TSDF& fine)
+            {
+                size_t numChanged = 0;
+                TSDF* src = &fine;
+                for(size_t l = 0; l < levels.size(); l++)
+                {
+                    const size_t changed = Downsample(*src, levels[l], lastVersions[l]);
+                    if(l == 0)
+                    {
+                        numChanged = changed;
+                    }
+                    src = &levels[l];
+                }
+                return numChanged;
+            }
+
+            std::vector<TSDF> levels;
+            // Version of the level above each level at its last Update.
+            std::vector<uint32_t> lastVersions;
+
+        protected:
+            // Recomputes the cells of dst under the tiles of src changed
+            // since lastVersion. Returns the number of those tiles.
+            static size_t Downsample(TSDF& src, TSDF& dst, uint32_t& lastVersion)
+            {
+                const uint32_t upTo = src.Checkpoint();
+                const int half = TSDF::TILE_SIZE >> 1;
+                size_t numChanged = 0;
+                for(int ty = 0; ty < src.tilesHigh; ty++)
+                {
+                    for(int tx = 0; tx < src.tilesWide; tx++)
+                    {
+                        if(!src.IsTileChanged(tx + ty * src.tilesWide, lastVersion, upTo))
+                        {
+                            continue;
+                        }
+                        numChanged++;
+
+                        const int x1 = std::min((tx + 1) * half, dst.width);
+                        const int y1 = std::min((ty + 1) * half, dst.height);
+                        for(int y = ty * half; y < y1; y++)
+                        {
+                            for(int x = tx * half; x < x1; x++)
+                            {
+                                dst.cells[dst.GetIdx(x, y)] = Reduce(src, 2 * x, 2 * y);
+                                dst.tileVersions[dst.GetTileIdx(x, y)] = dst.version;
+                            }
+                        }
+                    }
+                }
+
+                lastVersion = upTo;
+                return numChanged;
+            }
+
+            // The cell covering src cells (x, y) to (x + 1, y + 1). Cells past
+            // the edge of src count as unobserved.
+            static inline TSDF::Cell Reduce(TSDF& src, int x, int y)
+            {
+                float weight = 0.0f;
+                float weightedDist = 0.0f;
+                for(int dy = 0; dy < 2; dy++)
+                {
+                    for(int dx = 0; dx < 2; dx++)
+                    {
+                        if(src.IsValid(x + dx, y + dy))
+                        {
+                            const TSDF::Cell& cell = src.cells[src.GetIdx(x + dx, y + dy)];
+                            weight += cell.weight;
+                            weightedDist += cell.weight * cell.dist;
+                        }
+                    }
+                }
+
+                TSDF::Cell reduced;
+                reduced.dist = weight > 0.0f ? weightedDist / weight : src.truncation;
+                reduced.weight = weight * 0.25f;
+                return reduced;
+            }
+    };
+}
+
+#endif // TSDFPYRAMID_H_
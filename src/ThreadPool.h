@@ -0,0 +1,183 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+namespace arm_slam
+{
+    class ThreadPool
+    {
+        public:
+            // numThreads == 0 uses one thread per hardware core.
+            ThreadPool(size_t numThreads = 0) :
+                pending(0),
+                stopping(false)
+            {
+                if(numThreads == 0)
+                {
+                    numThreads = GetHardwareThreads();
+                }
+
+                for(size_t i = 0; i < numThreads; i++)
+                {
+                    workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+                }
+            }
+
+            virtual ~ThreadPool()
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                taskAvailable.notify_all();
+
+                for(size_t i = 0; i < workers.size(); i++)
+                {
+                    workers[i].join();
+                }
+            }
+
+            void Enqueue(const std::function<void()>& task)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    tasks.push_back(task);
+                    pending++;
+                }
+                taskAvailable.notify_one();
+            }
+
+            // Blocks until every enqueued task has finished.
+            void Wait()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                allDone.wait(lock, [this] { return pending == 0; });
+            }
+
+            inline size_t GetNumThreads() const
+            {
+                return workers.size();
+            }
+
+            static size_t GetHardwareThreads()
+            {
+                size_t n = std::thread::hardware_concurrency();
+                return n > 0 ? n : 1;
+            }
+
+        protected:
+            void WorkerLoop()
+            {
+                while(true)
+                {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+                        if(tasks.empty())
+                        {
+                            return;
+                        }
+
+                        task = tasks.front();
+                        tasks.pop_front();
+                    }
+
+                    task();
+
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        pending--;
+                        if(pending == 0)
+                        {
+                            allDone.notify_all();
+                        }
+                    }
+                }
+            }
+
+            std::vector<std::thread> workers;
+            std::deque<std::function<void()> > tasks;
+            std::mutex mutex;
+            std::condition_variable taskAvailable;
+            std::condition_variable allDone;
+            size_t pending;
+            bool stopping;
+    };
+
+    // Splits [begin, end) into numThreads contiguous chunks and calls
+    // f(chunkBegin, chunkEnd) for each, one chunk on the calling thread.
+    template <typename F> void ParallelFor(size_t begin, size_t end, size_t numThreads, const F& f)
+    {
+        const size_t count = end > begin ? end - begin : 0;
+        if(numThreads == 0)
+        {
+            numThreads = ThreadPool::GetHardwareThreads();
+        }
+        numThreads = std::min(numThreads, count);
+
+        if(numThreads <= 1)
+        {
+            if(count > 0)
+            {
+                f(begin, end);
+            }
+            return;
+        }
+
+        const size_t chunk = (count + numThreads - 1) / numThreads;
+        std::vector<std::thread> threads;
+        for(size_t start = begin + chunk; start < end; start += chunk)
+        {
+            const size_t stop = std::min(start + chunk, end);
+            threads.push_back(std::thread([&f, start, stop] { f(start, stop); }));
+        }
+
+        f(begin, std::min(begin + chunk, end));
+
+        for(size_t i = 0; i < threads.size(); i++)
+        {
+            threads[i].join();
+        }
+    }
+
+    // As ParallelFor, but runs all chunks but the first on pool and passes
+    // each chunk its index in [0, numChunks) as f(index, chunkBegin,
+    // chunkEnd), so callers can give every chunk its own scratch. Waits
+    // for the whole pool, so nothing else should be using it meanwhile.
+    template <typename F> void ParallelFor(ThreadPool& pool, size_t begin, size_t end, size_t numChunks, const F& f)
+    {
+        const size_t count = end > begin ? end - begin : 0;
+        numChunks = std::min(numChunks, count);
+
+        if(numChunks <= 1)
+        {
+            if(count > 0)
+            {
+                f(0, begin, end);
+            }
+            return;
+        }
+
+        const size_t chunk = (count + numChunks - 1) / numChunks;
+        size_t index = 1;
+        for(size_t start = begin + chunk; start < end; start += chunk, index++)
+        {
+            const size_t stop = std::min(start + chunk, end);
+            pool.Enqueue([&f, index, start, stop] { f(index, start, stop); });
+        }
+
+        f(0, begin, std::min(begin + chunk, end));
+        pool.Wait();
+    }
+}
+
+#endif // THREADPOOL_H_
@@ -0,0 +1,403 @@
+#include "TrajectoryIO.h"
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace arm_slam
+{
+    static const char MAGIC[4] = {'A', 'S', 'L', 'T'};
+
+    TrajectoryIO::Format TrajectoryIO::GetFormat(const std::string& file)
+    {
+        const std::string extension = ".bin";
+        if (file.size() >= extension.size() && file.compare(file.size() - extension.size(), extension.size(), extension) == 0)
+        {
+            return Binary;
+        }
+        return Text;
+    }
+
+    bool TrajectoryIO::Convert(const std::string& in, const std::string& out, const std::vector<std::string>& columns, uint32_t dof)
+    {
+        TrajectoryReader reader;
+        if (!reader.Open(in))
+        {
+            return false;
+        }
+
+        std::vector<std::string> names;
+        for (size_t c = 0; c < reader.GetNumColumns(); c++)
+        {
+            if (reader.GetFormat() == Text && c < columns.size())
+            {
+                names.push_back(columns[c]);
+            }
+            else
+            {
+                names.push_back(reader.GetColumnName(c));
+            }
+        }
+
+        TrajectoryWriter writer;
+        if (!writer.Open(out, GetFormat(out), names, reader.GetFormat() == Text ? dof : reader.GetDOF()))
+        {
+            return false;
+        }
+
+        std::vector<float> row(names.size());
+        for (uint64_t r = 0; r < reader.GetNumRows(); r++)
+        {
+            reader.GetRow(r, &row[0]);
+            writer.Append(&row[0]);
+        }
+        return writer.Close();
+    }
+
+    TrajectoryWriter::TrajectoryWriter() :
+            stream(NULL),
+            format(TrajectoryIO::Text),
+            numColumns(0),
+            rowsPerChunk(0),
+            numRows(0),
+            chunkRows(0),
+            failed(false)
+    {
+
+    }
+
+    TrajectoryWriter::~TrajectoryWriter()
+    {
+        Close();
+    }
+
+    bool TrajectoryWriter::Open(const std::string& file, TrajectoryIO::Format format_, const std::vector<std::string>& columns, uint32_t dof, uint32_t rowsPerChunk_)
+    {
+        Close();
+        if (columns.empty() || rowsPerChunk_ == 0)
+        {
+            return false;
+        }
+
+        stream = fopen(file.c_str(), "wb");
+        if (!stream)
+        {
+            return false;
+        }
+
+        format = format_;
+        numColumns = columns.size();
+        rowsPerChunk = rowsPerChunk_;
+        numRows = 0;
+        chunkRows = 0;
+        failed = false;
+        setvbuf(stream, NULL, _IOFBF, 1 << 16);
+
+        if (format == TrajectoryIO::Binary)
+        {
+            TrajectoryIO::Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = TrajectoryIO::VERSION;
+            header.dof = dof;
+            header.numColumns = (uint32_t)numColumns;
+            header.rowsPerChunk = rowsPerChunk;
+            failed |= fwrite(&header, sizeof(header), 1, stream) != 1;
+
+            for (size_t c = 0; c < numColumns; c++)
+            {
+                char name[TrajectoryIO::NAME_LENGTH];
+                memset(name, 0, sizeof(name));
+                strncpy(name, columns[c].c_str(), sizeof(name) - 1);
+                failed |= fwrite(name, sizeof(name), 1, stream) != 1;
+            }
+            chunk.assign(numColumns * rowsPerChunk, 0.0f);
+        }
+        return !failed;
+    }
+
+    void TrajectoryWriter::Append(const float* row)
+    {
+        if (!stream)
+        {
+            return;
+        }
+
+        numRows++;
+        if (format == TrajectoryIO::Text)
+        {
+            for (size_t c = 0; c < numColumns; c++)
+            {
+                // %g prints what operator<< prints by default.
+                fprintf(stream, c == 0 ? "%g" : " %g", row[c]);
+            }
+            fputc('\n', stream);
+            return;
+        }
+
+        for (size_t c = 0; c < numColumns; c++)
+        {
+            chunk[c * rowsPerChunk + chunkRows] = row[c];
+        }
+        chunkRows++;
+        if (chunkRows == rowsPerChunk)
+        {
+            failed |= !WriteChunk();
+        }
+    }
+
+    bool TrajectoryWriter::WriteChunk()
+    {
+        bool ok = true;
+        if (chunkRows == rowsPerChunk)
+        {
+            ok = fwrite(&chunk[0], sizeof(float), chunk.size(), stream) == chunk.size();
+        }
+        else
+        {
+            // The last chunk is packed to its own row count.
+            for (size_t c = 0; c < numColumns && ok; c++)
+            {
+                ok = fwrite(&chunk[c * rowsPerChunk], sizeof(float), chunkRows, stream) == chunkRows;
+            }
+        }
+        chunkRows = 0;
+        return ok;
+    }
+
+    bool TrajectoryWriter::Close()
+    {
+        if (!stream)
+        {
+            return false;
+        }
+
+        if (format == TrajectoryIO::Binary)
+        {
+            if (chunkRows > 0)
+            {
+                failed |= !WriteChunk();
+            }
+
+            const long offset = (long)offsetof(TrajectoryIO::Header, numRows);
+            failed |= fseek(stream, offset, SEEK_SET) != 0;
+            failed |= fwrite(&numRows, sizeof(numRows), 1, stream) != 1;
+        }
+
+        failed |= fclose(stream) != 0;
+        stream = NULL;
+        chunk.clear();
+        return !failed;
+    }
+
+    TrajectoryReader::TrajectoryReader() :
+            format(TrajectoryIO::Text),
+            dof(0),
+            rowsPerChunk(1),
+            numRows(0),
+            data(NULL),
+            mapped(NULL),
+            mappedSize(0)
+    {
+
+    }
+
+    TrajectoryReader::~TrajectoryReader()
+    {
+        Close();
+    }
+
+    bool TrajectoryReader::Open(const std::string& file)
+    {
+        Close();
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        char magic[4] = {0, 0, 0, 0};
+        const bool isBinary = ok && info.st_size >= (off_t)sizeof(TrajectoryIO::Header) && read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+        if (ok && isBinary)
+        {
+            ok = OpenBinary(fd, (size_t)info.st_size);
+        }
+        close(fd);
+
+        if (ok && !isBinary)
+        {
+            ok = OpenText(file);
+        }
+
+        if (!ok)
+        {
+            Close();
+        }
+        return ok;
+    }
+
+    bool TrajectoryReader::OpenBinary(int fd, size_t size)
+    {
+        mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            mapped = NULL;
+            return false;
+        }
+        mappedSize = size;
+
+        const char* bytes = (const char*)mapped;
+        TrajectoryIO::Header header;
+        memcpy(&header, bytes, sizeof(header));
+        const size_t namesEnd = sizeof(header) + (size_t)header.numColumns * TrajectoryIO::NAME_LENGTH;
+        if (header.version != TrajectoryIO::VERSION || header.numColumns == 0 || header.rowsPerChunk == 0 || namesEnd > size)
+        {
+            return false;
+        }
+
+        format = TrajectoryIO::Binary;
+        dof = header.dof;
+        rowsPerChunk = header.rowsPerChunk;
+        for (size_t c = 0; c < header.numColumns; c++)
+        {
+            const char* name = bytes + sizeof(header) + c * TrajectoryIO::NAME_LENGTH;
+            columns.push_back(std::string(name, strnlen(name, TrajectoryIO::NAME_LENGTH)));
+        }
+
+        const uint64_t numValues = (size - namesEnd) / sizeof(float);
+        if (header.numRows == 0)
+        {
+            const uint64_t chunkValues = (uint64_t)rowsPerChunk * header.numColumns;
+            numRows = numValues / chunkValues * rowsPerChunk;
+        }
+        else if (header.numRows * header.numColumns <= numValues)
+        {
+            numRows = header.numRows;
+        }
+        else
+        {
+            return false;
+        }
+        data = (const float*)(bytes + namesEnd);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    bool TrajectoryReader::OpenText(const std::string& file)
+    {
+        FILE* stream = fopen(file.c_str(), "rb");
+        if (!stream)
+        {
+            return false;
+        }
+        std::string text;
+        char buffer[1 << 16];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+        {
+            text.append(buffer, read);
+        }
+        fclose(stream);
+
+        // Rows are parsed row by row, then transposed into one chunk.
+        std::vector<float> rows;
+        size_t numColumns = 0;
+        const char* p = text.c_str();
+        const char* end = p + text.size();
+        while (p < end)
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+            if (!lineEnd)
+            {
+                lineEnd = end;
+            }
+
+            const std::string line(p, lineEnd);
+            const char* s = line.c_str();
+            size_t count = 0;
+            while (true)
+            {
+                char* next;
+                const float value = strtof(s, &next);
+                if (next == s)
+                {
+                    break;
+                }
+                rows.push_back(value);
+                count++;
+                s = next;
+            }
+
+            while (*s == ' ' || *s == '\t' || *s == '\r')
+            {
+                s++;
+            }
+            if (*s != '\0')
+            {
+                return false;
+            }
+
+            if (count > 0)
+            {
+                if (numColumns == 0)
+                {
+                    numColumns = count;
+                }
+                else if (count != numColumns)
+                {
+                    return false;
+                }
+            }
+            p = lineEnd + 1;
+        }
+
+        if (numColumns == 0)
+        {
+            return false;
+        }
+
+        format = TrajectoryIO::Text;
+        numRows = rows.size() / numColumns;
+        rowsPerChunk = numRows > 0 ? (uint32_t)numRows : 1;
+        parsed.resize(rows.size());
+        for (size_t r = 0; r < numRows; r++)
+        {
+            for (size_t c = 0; c < numColumns; c++)
+            {
+                parsed[c * numRows + r] = rows[r * numColumns + c];
+            }
+        }
+        for (size_t c = 0; c < numColumns; c++)
+        {
+            std::stringstream name;
+            name << "c" << c;
+            columns.push_back(name.str());
+        }
+        data = parsed.empty() ? NULL : &parsed[0];
+        return true;
+    }
+
+    void TrajectoryReader::Close()
+    {
+        if (mapped)
+        {
+            munmap(mapped, mappedSize);
+        }
+        mapped = NULL;
+        mappedSize = 0;
+        data = NULL;
+        parsed.clear();
+        columns.clear();
+        format = TrajectoryIO::Text;
+        dof = 0;
+        rowsPerChunk = 1;
+        numRows = 0;
+    }
+
+}
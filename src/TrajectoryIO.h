@@ -0,0 +1,171 @@
+#ifndef TRAJECTORYIO_H_
+#define TRAJECTORYIO_H_
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <algorithm>
+#include <stdint.h>
+
+namespace arm_slam
+{
+    // Tables of float rows, such as recorded trajectories and per step
+    // experiment data, in either of two formats:
+    //
+    // Text: one row per line, values separated by spaces, as the app has
+    // always written them.
+    //
+    // Binary: a Header, numColumns names of NAME_LENGTH bytes, then the rows
+    // in chunks of rowsPerChunk. A chunk stores its rows column by column,
+    // so a column is contiguous within a chunk and every chunk but the last
+    // has the same size. Values are native floats. numRows is written when
+    // the file is closed; a file whose writer never closed it has numRows 0
+    // and is read up to its last complete chunk.
+    class TrajectoryIO
+    {
+        public:
+            static const uint32_t VERSION = 1;
+            static const size_t NAME_LENGTH = 32;
+            static const uint32_t DEFAULT_ROWS_PER_CHUNK = 4096;
+
+            enum Format
+            {
+                Text,
+                Binary
+            };
+
+            struct Header
+            {
+                    char magic[4];
+                    uint32_t version;
+                    // Degrees of freedom of the robot the rows describe.
+                    uint32_t dof;
+                    uint32_t numColumns;
+                    uint32_t rowsPerChunk;
+                    uint32_t reserved;
+                    uint64_t numRows;
+            };
+
+            // Binary for files ending in ".bin", text otherwise.
+            static Format GetFormat(const std::string& file);
+
+            // Rewrites in as out in the format GetFormat picks for out. Text
+            // files carry no schema, so columns and dof name the columns of
+            // a text input; they default to c0, c1, ... and 0.
+            static bool Convert(const std::string& in, const std::string& out, const std::vector<std::string>& columns = std::vector<std::string>(), uint32_t dof = 0);
+    };
+
+    // Appends rows to a file as they come. Binary rows are buffered a chunk
+    // at a time, text rows by the C library; neither flushes per row.
+    class TrajectoryWriter
+    {
+        public:
+            TrajectoryWriter();
+            virtual ~TrajectoryWriter();
+
+            bool Open(const std::string& file, TrajectoryIO::Format format, const std::vector<std::string>& columns, uint32_t dof, uint32_t rowsPerChunk = TrajectoryIO::DEFAULT_ROWS_PER_CHUNK);
+
+            inline bool IsOpen() const
+            {
+                return stream != NULL;
+            }
+
+            // row holds one value per column.
+            void Append(const float* row);
+
+            // Writes the last chunk and the row count. Returns false if any
+            // write since Open failed.
+            bool Close();
+
+            inline uint64_t GetNumRows() const
+            {
+                return numRows;
+            }
+
+        protected:
+            bool WriteChunk();
+
+            FILE* stream;
+            TrajectoryIO::Format format;
+            size_t numColumns;
+            uint32_t rowsPerChunk;
+            uint64_t numRows;
+            // The current chunk, column by column with rowsPerChunk slots
+            // per column.
+            std::vector<float> chunk;
+            uint32_t chunkRows;
+            bool failed;
+    };
+
+    // Random access to a file written by TrajectoryWriter. Binary files are
+    // memory mapped and read in place; text files are parsed into the same
+    // chunked layout as a single chunk.
+    class TrajectoryReader
+    {
+        public:
+            TrajectoryReader();
+            virtual ~TrajectoryReader();
+
+            bool Open(const std::string& file);
+            void Close();
+
+            inline uint64_t GetNumRows() const
+            {
+                return numRows;
+            }
+
+            inline size_t GetNumColumns() const
+            {
+                return columns.size();
+            }
+
+            inline uint32_t GetDOF() const
+            {
+                return dof;
+            }
+
+            inline const std::string& GetColumnName(size_t col) const
+            {
+                return columns[col];
+            }
+
+            inline TrajectoryIO::Format GetFormat() const
+            {
+                return format;
+            }
+
+            inline float Get(uint64_t row, size_t col) const
+            {
+                const uint64_t chunkIdx = row / rowsPerChunk;
+                const uint64_t first = chunkIdx * rowsPerChunk;
+                const uint64_t chunkRows = std::min<uint64_t>(rowsPerChunk, numRows - first);
+                return data[first * columns.size() + col * chunkRows + (row - first)];
+            }
+
+            inline void GetRow(uint64_t row, float* out) const
+            {
+                for (size_t c = 0; c < columns.size(); c++)
+                {
+                    out[c] = Get(row, c);
+                }
+            }
+
+        protected:
+            bool OpenBinary(int fd, size_t size);
+            bool OpenText(const std::string& file);
+
+            TrajectoryIO::Format format;
+            std::vector<std::string> columns;
+            uint32_t dof;
+            uint32_t rowsPerChunk;
+            uint64_t numRows;
+            const float* data;
+            // The mapping of a binary file.
+            void* mapped;
+            size_t mappedSize;
+            // The values of a text file.
+            std::vector<float> parsed;
+    };
+}
+
+#endif // TRAJECTORYIO_H_
@@ -3,7 +3,9 @@
 namespace arm_slam
 {
 
-    World::World()
+    World::World() :
+            width(0),
+            height(0)
     {
         // TODO Auto-generated constructor stub
 
@@ -2,6 +2,8 @@
 #define WORLD_H_
 
 #include "ofMain.h"
+#include "DistanceTransform.h"
+#include "OccupancyGrid.h"
 
 namespace arm_slam
 {
@@ -12,25 +14,21 @@ namespace arm_slam
             World();
             virtual ~World();
 
-            bool IsValid(int x, int y)
+            inline bool IsValid(int x, int y) const
             {
-                return x >= 0 && x < data.getWidth() && y >= 0 && y < data.getHeight();
+                return occupancy.IsValid(x, y);
             }
 
-            bool Collides(int x, int y)
+            inline bool Collides(int x, int y) const
             {
-                if(IsValid(x, y))
-                {
-                    return collisionBuffer[(x + y * data.getWidth())];
-                }
-                return true;
+                return occupancy.Collides(x, y);
             }
 
             float GetDist(int x, int y)
             {
                 if(IsValid(x, y))
                 {
-                    return signedDistance[(x + y * data.getWidth())];
+                    return signedDistance[(x + y * width)];
                 }
                 else
                 {
@@ -38,6 +36,12 @@ namespace arm_slam
                 }
             }
 
+            // (x, y) must be valid.
+            inline float GetDistUnchecked(int x, int y) const
+            {
+                return signedDistance[x + y * width];
+            }
+
             ofVec2f GetGradient(int x, int y)
             {
                 /*
@@ -47,6 +51,15 @@ namespace arm_slam
                 return ofVec2f(dx - d0, dy - d0) * d0;
                 */
 
+                if(occupancy.IsInPadding(x - 1, y - 1) && occupancy.IsInPadding(x + 1, y + 1))
+                {
+                    int dxplus = (int)occupancy.Get(x + 1, y);
+                    int dyplus = (int)occupancy.Get(x, y + 1);
+                    int dxminus = (int)occupancy.Get(x - 1, y);
+                    int dyminus = (int)occupancy.Get(x, y - 1);
+                    return ofVec2f((dxplus - dxminus) * 0.5f, (dyplus - dyminus) * 0.5f);
+                }
+
                 int dxplus = (int)Collides(x + 1, y);
                 int dyplus = (int)Collides(x, y + 1);
                 int dxminus = (int)Collides(x - 1, y);
@@ -55,24 +68,55 @@ namespace arm_slam
 
             }
 
-            void Initialize()
+            // The map interface of the trackers. The world's gradient is the
+            // occupancy edge normal of the simulated sensor, so it isn't
+            // interpolated.
+            inline ofVec2f SampleGradient(float x, float y)
+            {
+                return GetGradient((int)x, (int)y);
+            }
+
+            inline bool IsSamplingInterpolated() const
+            {
+                return false;
+            }
+
+            bool Load(const std::string& worldFile, bool useTexture)
+            {
+                data.setUseTexture(useTexture);
+                if(!data.loadImage(worldFile))
+                {
+                    return false;
+                }
+                Initialize();
+                return true;
+            }
+
+            // Builds the occupancy grid and the signed distance field from
+            // data. numThreads == 0 uses every core for the distance transform.
+            void Initialize(size_t numThreads = 0, OccupancyGrid::Layout layout = OccupancyGrid::RowMajor)
             {
-                collisionBuffer.resize(data.getWidth() * data.getHeight());
-                signedDistance.resize(distdata.getWidth() * distdata.getHeight());
-                for (int x = 0; x< data.getWidth(); x++)
+                width = data.getWidth();
+                height = data.getHeight();
+                std::vector<unsigned char> collisionBuffer(width * height, 0);
+                occupancy.Initialize(width, height, layout);
+                for (int x = 0; x < width; x++)
                 {
-                    for(int y = 0; y < data.getHeight(); y++)
+                    for(int y = 0; y < height; y++)
                     {
-                        collisionBuffer[x + y * data.getWidth()] = data.getColor(x, y).r == 0;
-                        ofColor dist = distdata.getColor(x, y);
-                        signedDistance[x + y * data.getWidth()] = (float)dist.r - (float)dist.g;
+                        bool collides = data.getColor(x, y).r == 0;
+                        collisionBuffer[x + y * width] = collides;
+                        occupancy.Set(x, y, collides);
                     }
                 }
+                occupancy.ComputeClearance();
+                DistanceTransform::ComputeSigned(collisionBuffer, width, height, signedDistance, numThreads);
             }
 
             ofImage data;
-            ofImage distdata;
-            std::vector<bool> collisionBuffer;
+            int width;
+            int height;
+            OccupancyGrid occupancy;
             std::vector<float>signedDistance;
     };
 
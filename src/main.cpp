@@ -1,11 +1,489 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "ExperimentRunner.h"
+#include "ExperimentSweep.h"
+#include "Profiler.h"
 
 #include "Definitions.h"
 #include "ofAppGlutWindow.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+static void PrintUsage(const char* exe)
+{
+    std::cerr << "usage: " << exe << " [--headless] [--mode groundtruth|odometry|constrained|unconstrained|gaussnewton|particle]\n"
+              << "       [--noise <scale>] [--traj <file>] [--out <file>] [--world <png>]\n"
+              << "       [--cast marching|grid|sphere] [--sparse] [--fusion-threads <n>]\n"
+              << "       [--particles <n>] [--particle-threads <n>] [--pyramid-levels <n>] [--coarse-iters <n>]\n"
+              << "       [--interpolate] [--cached-gradients] [--async-mapping] [--mapping-queue <n>] [--mapping-wait]\n"
+              << "       [--load-map <file>] [--save-map <file>] [--checkpoint <file>] [--checkpoint-interval <steps>]\n"
+              << "       [--full-error] [--error-check <steps>] [--trace <file>]\n"
+              << "   or: " << exe << " --sweep [--modes <list>] [--noises <list>] [--truncations <list>]\n"
+              << "       [--iters <list>] [--rates <list>] [--translation-steps <list>] [--rotation-steps <list>]\n"
+              << "       [--resolutions <list>] [--threads <n>] [--outdir <dir>] [--traj <file>] [--world <png>]\n"
+              << "       lists are comma separated\n"
+              << "   or: " << exe << " --convert <in> <out>\n"
+              << "       rewrites a trajectory or experiment file, as binary if <out> ends in .bin" << std::endl;
+}
+
+template <typename T> static std::vector<T> ParseList(const char* arg)
+{
+    std::vector<T> values;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        values.push_back((T)atof(item.c_str()));
+    }
+    return values;
+}
+
+// Reads a count of at least minimum into count. Counts are unsigned, so a
+// negative value would wrap around to a huge one instead of failing.
+static bool ParseCount(const char* name, const char* value, size_t minimum, size_t& count)
+{
+    const long n = atol(value);
+    if (n < (long)minimum)
+    {
+        if (minimum == 0)
+        {
+            std::cerr << name << " must not be negative" << std::endl;
+        }
+        else
+        {
+            std::cerr << name << " must be at least " << minimum << std::endl;
+        }
+        return false;
+    }
+    count = (size_t)n;
+    return true;
+}
+
+static bool ParseModes(const char* arg, std::vector<arm_slam::ExperimentRunner::Experiment>& modes)
+{
+    modes.clear();
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        arm_slam::ExperimentRunner::Experiment mode;
+        if (!arm_slam::ExperimentRunner::ParseExperiment(item, mode))
+        {
+            std::cerr << "unknown mode " << item << std::endl;
+            return false;
+        }
+        modes.push_back(mode);
+    }
+    return true;
+}
+
+static bool ParseCastMode(const std::string& name, arm_slam::DepthCamera::CastMode& mode)
+{
+    if (name == "marching")
+    {
+        mode = arm_slam::DepthCamera::Marching;
+    }
+    else if (name == "grid")
+    {
+        mode = arm_slam::DepthCamera::GridTraversal;
+    }
+    else if (name == "sphere")
+    {
+        mode = arm_slam::DepthCamera::SphereTracing;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Runs every combination of the given parameter lists across a thread pool.
+static int RunSweep(int argc, char* argv[])
+{
+    arm_slam::ExperimentSweep sweep;
+    std::string trajFile = "./data/traj.txt";
+    std::string outDir = "./data";
+    std::string worldFile = "world.png";
+    size_t numThreads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--sweep") == 0)
+        {
+            continue;
+        }
+        else if (strcmp(arg, "--modes") == 0 && hasValue)
+        {
+            if (!ParseModes(argv[++i], sweep.modes))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--noises") == 0 && hasValue)
+        {
+            sweep.jointNoiseScales = ParseList<float>(argv[++i]);
+        }
+        else if (strcmp(arg, "--truncations") == 0 && hasValue)
+        {
+            sweep.truncations = ParseList<float>(argv[++i]);
+        }
+        else if (strcmp(arg, "--iters") == 0 && hasValue)
+        {
+            sweep.descentIters = ParseList<int>(argv[++i]);
+        }
+        else if (strcmp(arg, "--rates") == 0 && hasValue)
+        {
+            sweep.descentRates = ParseList<float>(argv[++i]);
+        }
+        else if (strcmp(arg, "--translation-steps") == 0 && hasValue)
+        {
+            sweep.freeTranslationSteps = ParseList<float>(argv[++i]);
+        }
+        else if (strcmp(arg, "--rotation-steps") == 0 && hasValue)
+        {
+            sweep.freeRotationSteps = ParseList<float>(argv[++i]);
+        }
+        else if (strcmp(arg, "--resolutions") == 0 && hasValue)
+        {
+            sweep.cameraResolutions = ParseList<float>(argv[++i]);
+        }
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+        {
+            if (!ParseCount(arg, argv[++i], 0, numThreads))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--outdir") == 0 && hasValue)
+        {
+            outDir = argv[++i];
+        }
+        else if (strcmp(arg, "--traj") == 0 && hasValue)
+        {
+            trajFile = argv[++i];
+        }
+        else if (strcmp(arg, "--world") == 0 && hasValue)
+        {
+            worldFile = argv[++i];
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    arm_slam::World world;
+    if (!world.Load(worldFile, false))
+    {
+        std::cerr << "could not load " << worldFile << std::endl;
+        return 1;
+    }
+
+    std::vector<arm_slam::ExperimentRunner::Config> trajectory;
+    if (!arm_slam::ExperimentRunner::LoadTrajectory(trajFile, trajectory))
+    {
+        std::cerr << "could not open " << trajFile << std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const bool saved = sweep.Run(world, trajectory, outDir, numThreads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < sweep.results.size(); i++)
+    {
+        if (!sweep.results[i].saved)
+        {
+            std::cerr << "could not write " << sweep.results[i].file << std::endl;
+        }
+    }
+
+    std::string summaryFile = outDir + "/sweep_summary.txt";
+    if (!sweep.SaveSummary(summaryFile))
+    {
+        std::cerr << "could not write " << summaryFile << std::endl;
+        return 1;
+    }
+
+    std::cout << sweep.results.size() << " runs in " << seconds << " s, wrote " << summaryFile << std::endl;
+    return saved ? 0 : 1;
+}
+
+// Replays a recorded trajectory without opening a window.
+static int RunHeadless(int argc, char* argv[])
+{
+    arm_slam::ExperimentRunner::Params params;
+    std::string trajFile = "./data/traj.txt";
+    std::string outFile = "./data/experiment.txt";
+    std::string worldFile = "world.png";
+    std::string loadMapFile;
+    std::string saveMapFile;
+    std::string traceFile;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--headless") == 0)
+        {
+            continue;
+        }
+        else if (strcmp(arg, "--mode") == 0 && hasValue)
+        {
+            if (!arm_slam::ExperimentRunner::ParseExperiment(argv[++i], params.mode))
+            {
+                std::cerr << "unknown mode " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--noise") == 0 && hasValue)
+        {
+            params.jointNoiseScale = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "--sparse") == 0)
+        {
+            params.sparseMap = true;
+        }
+        else if (strcmp(arg, "--fusion-threads") == 0 && hasValue)
+        {
+            if (!ParseCount(arg, argv[++i], 0, params.fusionThreads))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--pyramid-levels") == 0 && hasValue)
+        {
+            params.pyramidLevels = atoi(argv[++i]);
+            if (params.pyramidLevels < 0)
+            {
+                std::cerr << "--pyramid-levels must not be negative" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--coarse-iters") == 0 && hasValue)
+        {
+            params.coarseIters = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--interpolate") == 0)
+        {
+            params.interpolatedSampling = true;
+        }
+        else if (strcmp(arg, "--cached-gradients") == 0)
+        {
+            params.interpolatedSampling = true;
+            params.cachedGradients = true;
+        }
+        else if (strcmp(arg, "--particles") == 0 && hasValue)
+        {
+            if (!ParseCount(arg, argv[++i], 1, params.particles))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--particle-threads") == 0 && hasValue)
+        {
+            if (!ParseCount(arg, argv[++i], 0, params.particleThreads))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--async-mapping") == 0)
+        {
+            params.asyncMapping = true;
+        }
+        else if (strcmp(arg, "--mapping-queue") == 0 && hasValue)
+        {
+            if (!ParseCount(arg, argv[++i], 1, params.mappingQueueSize))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--mapping-wait") == 0)
+        {
+            params.mappingBlocks = true;
+        }
+        else if (strcmp(arg, "--full-error") == 0)
+        {
+            params.incrementalError = false;
+        }
+        else if (strcmp(arg, "--error-check") == 0 && hasValue)
+        {
+            params.errorCheckInterval = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--trace") == 0 && hasValue)
+        {
+            traceFile = argv[++i];
+        }
+        else if (strcmp(arg, "--load-map") == 0 && hasValue)
+        {
+            loadMapFile = argv[++i];
+        }
+        else if (strcmp(arg, "--save-map") == 0 && hasValue)
+        {
+            saveMapFile = argv[++i];
+        }
+        else if (strcmp(arg, "--checkpoint") == 0 && hasValue)
+        {
+            params.checkpointFile = argv[++i];
+        }
+        else if (strcmp(arg, "--checkpoint-interval") == 0 && hasValue)
+        {
+            params.checkpointInterval = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--cast") == 0 && hasValue)
+        {
+            if (!ParseCastMode(argv[++i], params.castMode))
+            {
+                std::cerr << "unknown cast mode " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--traj") == 0 && hasValue)
+        {
+            trajFile = argv[++i];
+        }
+        else if (strcmp(arg, "--out") == 0 && hasValue)
+        {
+            outFile = argv[++i];
+        }
+        else if (strcmp(arg, "--world") == 0 && hasValue)
+        {
+            worldFile = argv[++i];
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    arm_slam::ExperimentRunner runner;
+    if (!runner.world.Load(worldFile, false))
+    {
+        std::cerr << "could not load " << worldFile << std::endl;
+        return 1;
+    }
+    runner.Initialize(params);
+
+    if (!loadMapFile.empty() && !runner.LoadMap(loadMapFile))
+    {
+        std::cerr << "could not load map " << loadMapFile << std::endl;
+        return 1;
+    }
+
+    if (!runner.LoadTrajectory(trajFile))
+    {
+        std::cerr << "could not open " << trajFile << std::endl;
+        return 1;
+    }
+
+    if (!runner.OpenLog(outFile))
+    {
+        std::cerr << "could not write " << outFile << std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t steps = runner.Run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!runner.CloseLog())
+    {
+        std::cerr << "could not write " << outFile << std::endl;
+        return 1;
+    }
+
+    if (!saveMapFile.empty() && !runner.SaveMap(saveMapFile))
+    {
+        std::cerr << "could not write map " << saveMapFile << std::endl;
+        return 1;
+    }
+
+    if (!traceFile.empty())
+    {
+        if (!arm_slam::Profiler::IsCompiledIn())
+        {
+            std::cerr << "built without ARM_SLAM_ENABLE_PROFILING, " << traceFile << " will be empty" << std::endl;
+        }
+
+        if (!arm_slam::Profiler::Get().SaveTrace(traceFile))
+        {
+            std::cerr << "could not write " << traceFile << std::endl;
+            return 1;
+        }
+    }
+
+    if (runner.numMappingSteps > 0)
+    {
+        std::cerr << "mapping lag: mean " << (double)runner.sumMappingLag / runner.numMappingSteps << ", max " << runner.maxMappingLag << " scans; "
+                  << runner.mapper.numDropped << " scans dropped, " << runner.mapper.numStalls << " waited for" << std::endl;
+    }
+
+    if (runner.numErrorMismatches > 0)
+    {
+        std::cerr << "incremental map error disagreed with the full scan " << runner.numErrorMismatches << " times" << std::endl;
+    }
+
+    std::cout << arm_slam::ExperimentRunner::GetExperimentName(params.mode) << ": " << steps << " steps in "
+              << seconds << " s, wrote " << outFile << std::endl;
+    return 0;
+}
+
+// Rewrites a trajectory or experiment file in the format of the output's
+// extension. Text inputs are named by their column count.
+static int RunConvert(const char* in, const char* out)
+{
+    std::vector<std::string> columns;
+    arm_slam::TrajectoryReader reader;
+    if (reader.Open(in))
+    {
+        const std::vector<std::string> trajectory = arm_slam::ExperimentRunner::GetTrajectoryColumns();
+        const std::vector<std::string> experiment = arm_slam::ExperimentRunner::GetExperimentColumns();
+        columns = reader.GetNumColumns() == experiment.size() ? experiment : trajectory;
+        reader.Close();
+    }
+
+    if (!arm_slam::TrajectoryIO::Convert(in, out, columns, arm_slam::ExperimentRunner::DOF))
+    {
+        std::cerr << "could not convert " << in << " to " << out << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 //========================================================================
-int main()
+int main(int argc, char* argv[])
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--sweep") == 0)
+        {
+            return RunSweep(argc, argv);
+        }
+
+        if (strcmp(argv[i], "--convert") == 0)
+        {
+            if (i + 2 >= argc)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            return RunConvert(argv[i + 1], argv[i + 2]);
+        }
+    }
+
+    if (argc > 1)
+    {
+        return RunHeadless(argc, argv);
+    }
+
     ofAppGlutWindow window;
     ofSetupOpenGL(&window, SCREEN_WIDTH, SCREEN_HEIGHT, OF_WINDOW); // <-------- setup the GL context
 
@@ -1,242 +1,77 @@
 #include "ofApp.h"
-#include <fstream>
+#include "Profiler.h"
+#include <sstream>
 
 //--------------------------------------------------------------
 void ofApp::setup()
 {
-    world.data.loadImage("world.png");
-    world.distdata.loadImage("dist.png");
-    world.Initialize();
-    float linkLengths[] = {50.0f, 40.0f, 25.0f};
-    robot.color = ofColor(200, 10, 10);
-    fakeRobot.color = ofColor(255, 255, 255, 100);
-    odomRobot.color = ofColor(100, 200, 100, 100);
-    robot.Initialize(linkLengths);
-    fakeRobot.Initialize(linkLengths);
-    odomRobot.Initialize(linkLengths);
-    Robot::Config config = robot.GetQ();
-    robot.SetQ(config);
-    fakeRobot.SetQ(config);
-    odomRobot.SetQ(config);
-    robot.root->localTranslation = ofVec2f(ofGetWidth() / 2, ofGetHeight() / 2);
-    fakeRobot.root->localTranslation = robot.root->localTranslation;
-    odomRobot.root->localTranslation = robot.root->localTranslation;
-    tsdf.Initialize(world, 32.0f);
-    tsdfImg.allocate(tsdf.width, tsdf.height, OF_IMAGE_COLOR_ALPHA);
-    tsdf.SetColors(&tsdfImg);
-    experimentMode = ConstrainedDescent;
-    jointNoiseScale = 0.25f;
-    zeroCalibration = GetJointNoise(robot.GetQ());
+    runner.world.Load("world.png", true);
+    arm_slam::ExperimentRunner::Params params;
+    params.mode = arm_slam::ExperimentRunner::ConstrainedDescent;
+    params.jointNoiseScale = 0.25f;
+    runner.Initialize(params);
+    tsdfImg.allocate(runner.world.width, runner.world.height, OF_IMAGE_COLOR_ALPHA);
+    tsdfImg.getPixels().setColor(ofColor(0, 0, 0, 0));
+    tsdfImg.update();
+    UpdateTsdfImage();
     writeTrajectory = true;
     readTrajectory = true;
     //readTrajectory = false;
     writeExperimentData = true;
-    iter = 0;
+    showProfiler = false;
 
     if (readTrajectory)
     {
-        LoadTrajectory();
-    }
-}
-
-void ofApp::LoadTrajectory()
-{
-    std::ifstream inputStream;
-    inputStream.open("./data/traj.txt", std::ios::in);
-
-    while (!inputStream.eof())
-    {
-        float a, b, c;
-        inputStream >> a;
-        inputStream >> b;
-        inputStream >> c;
-        Config config;
-        config(0) = a;
-        config(1) = b;
-        config(2) = c;
-        recordedTrajectory.push_back(config);
-    }
-}
-
-ofApp::Robot::Config ofApp::GetJointNoise(const  Robot::Config& curr)
-{
-    Robot::Config perturbation;
-    perturbation[0] = jointNoiseScale * (ofNoise((float)curr(0), (float)curr(1), (float)curr(2) + 0.5f) - 0.5f);
-    perturbation[1] = jointNoiseScale * (ofNoise((float)curr(0), (float)curr(1) + 0.5f, (float)curr(2)) - 0.5f);
-    perturbation[2] = jointNoiseScale * (ofNoise((float)curr(0) + 0.5f, (float)curr(1), (float)curr(2)) - 0.5f);
-    return perturbation;
-}
-
-void ofApp::AppendExperimentDatum()
-{
-    ExperimentDatum datum;
-    datum.odomConfig = odomRobot.GetQ();
-    datum.trackConfig = fakeRobot.GetQ();
-    datum.robotConfig = robot.GetQ();
-
-    ofVec2f truePos = robot.GetEEPos();
-    ofVec2f trackPos = fakeRobot.GetEEPos();
-    switch (experimentMode)
-    {
-        case GroundTruth:
-        case ConstrainedDescent:
-        case Odometry:
-            datum.eePosError = (truePos - trackPos).length();
-            break;
-        case UnconstraintedDescent:
-            datum.eePosError = (truePos - freeCamera.globalTranslation).length();
-            break;
-    }
-
-    tsdf.ComputeError(world, datum.classificationError, datum.tsdfError);
-    experimentData.push_back(datum);
-}
-
-void ofApp::SaveExperimentData()
-{
-    std::ofstream stream;
-    stream.open("./data/experiment.txt", std::ios::out);
-
-    for (size_t i = 0; i < experimentData.size(); i++)
-    {
-        ExperimentDatum& datum = experimentData.at(i);
-        stream << datum.tsdfError << " " << datum.classificationError << " " << datum.eePosError
-                << " " << datum.odomConfig(0) << " " << datum.odomConfig(1) << " " << datum.odomConfig(2)
-                << " " << datum.trackConfig(0) << " " << datum.trackConfig(1) << " " << datum.trackConfig(2)
-                << " " << datum.robotConfig(0) << " " << datum.robotConfig(1) << " " << datum.robotConfig(2) << std::endl;
+        runner.LoadTrajectory("./data/traj.txt");
     }
 }
 
 //--------------------------------------------------------------
 void ofApp::update()
 {
-    ofVec2f odomEE = odomRobot.GetEEPos();
-    float odomRotation = odomRobot.camera->globalRotation;
-    if((mouseX > 0 && mouseY > 0) || readTrajectory)
+    ARM_SLAM_PROFILE_SCOPE("frame");
+    Robot& robot = runner.robot;
+    if (readTrajectory)
     {
-        Robot::Config curr;
-        if(!readTrajectory)
-        {
-            ofVec2f ee = robot.GetEEPos();
-            ofVec2f force = ee - ofVec2f(mouseX, mouseY);
-            Robot::Config vel = robot.ComputeJacobianTransposeMove(force);
-            curr = robot.GetQ();
-            robot.SetQ(curr + vel * 1e-5);
-        }
-        else
-        {
-            if(iter < recordedTrajectory.size())
-            {
-                robot.SetQ(recordedTrajectory[iter]);
-                curr = robot.GetQ();
-            }
-            else
-            {
-                SaveExperimentData();
-                exit();
-            }
-        }
-        robot.Update(world);
-        Robot::Config perturbation = GetJointNoise(curr) + zeroCalibration * -1.0f;
-        switch (experimentMode)
+        if (!runner.Step())
         {
-            case GroundTruth:
+            if (writeExperimentData)
             {
-                fakeRobot.SetQ(robot.GetQ());
-                Robot::Config odom = robot.GetQ() + perturbation;
-                odomRobot.SetQ(odom);
-                break;
+                runner.SaveExperimentData("./data/experiment.txt");
             }
-            case Odometry:
-            case UnconstraintedDescent:
-            case ConstrainedDescent:
-                Robot::Config fake = robot.GetQ() + offset + perturbation;
-                fakeRobot.SetQ(fake);
-                Robot::Config odom = robot.GetQ() + perturbation;
-                odomRobot.SetQ(odom);
-                break;
+            ofExit();
+            return;
         }
-        iter++;
     }
-
-    fakeRobot.Update(world);
-    odomRobot.Update(world);
-
-    ofVec2f odomEEAfter = odomRobot.GetEEPos();
-    float odomRotationAfter = odomRobot.camera->globalRotation;
-
-    robot.camera->ComputeGradients(world, false);
-    fakeRobot.camera->points = robot.camera->points;
-    fakeRobot.camera->noisyPoints = robot.camera->noisyPoints;
-    fakeRobot.camera->ComputeGradients(tsdf, true);
-    //fakeRobot.camera->gradients = robot.camera->gradients;
-    switch(experimentMode)
+    else
     {
-        case GroundTruth:
+        Robot::Config curr = robot.GetQ();
+        if (mouseX > 0 && mouseY > 0)
         {
-            fakeRobot.SetQ(robot.GetQ());
-            break;
-        }
-        case Odometry:
-        {
-            break;
-        }
-        case ConstrainedDescent:
-        {
-            fakeRobot.GradientDescent(100, -1e-7, tsdf);
-            break;
-        }
-        case UnconstraintedDescent:
-        {
-            freeCamera.localRotation += (odomRotationAfter - odomRotation);
-            freeCamera.localTranslation += (odomEEAfter - odomEE);
-            freeCamera.points = robot.camera->points;
-            freeCamera.noisyPoints = robot.camera->noisyPoints;
-            freeCamera.UpdateRecursive();
-            freeCamera.ComputeGradients(tsdf, true);
-            freeCamera.FreeGradientDescent(tsdf, 100, 0.5f, -1e-6);
-            break;
+            ofVec2f ee = robot.GetEEPos();
+            ofVec2f force = ee - ofVec2f(mouseX, mouseY);
+            Robot::Config vel = robot.ComputeJacobianTransposeMove(force);
+            curr = curr + vel * 1e-5;
         }
+        runner.Step(curr);
     }
 
-    offset = fakeRobot.GetQ() + odomRobot.GetQ() * -1.0f;
-
     if(errs.size() > 500)
     {
         errs.erase(errs.begin());
     }
 
-    Robot::Config delta = fakeRobot.GetQ() + robot.GetQ() * -1;
+    Robot::Config delta = runner.fakeRobot.GetQ() + robot.GetQ() * -1;
 
     float err = (delta.Transpose() * delta)[0];
     errs.push_back(err);
 
-    switch(experimentMode)
-    {
-        case ConstrainedDescent:
-        case GroundTruth:
-        case Odometry:
-        {
-            tsdf.FuseRayCloud(fakeRobot.camera->globalTranslation, fakeRobot.camera->globalRotation, fakeRobot.camera->noisyPoints, robot.camera->gradients);
-            tsdf.SetColors(&tsdfImg);
-            break;
-        }
-        case UnconstraintedDescent:
-        {
-            tsdf.FuseRayCloud(freeCamera.globalTranslation, freeCamera.globalRotation, freeCamera.noisyPoints,  robot.camera->gradients);
-            tsdf.SetColors(&tsdfImg);
-        }
-    }
+    UpdateTsdfImage();
 
     if (writeTrajectory)
     {
         recordedTrajectory.push_back(robot.GetQ());
     }
-
-    if (readTrajectory)
-    {
-        AppendExperimentDatum();
-    }
 }
 
 //--------------------------------------------------------------
@@ -245,26 +80,32 @@ void ofApp::draw()
     ofHideCursor();
     ofClear(0);
     ofSetColor(255, 255, 255);
-    world.data.draw(0, 0);
+    runner.world.data.draw(0, 0);
     tsdfImg.draw(0, 0);
-    robot.Draw(false);
-    switch(experimentMode)
-    {
-        case ConstrainedDescent:
-        case GroundTruth:
-        case Odometry:
-            fakeRobot.Draw(true);
+    runner.robot.Draw(false);
+    switch(runner.params.mode)
+    {
+        case arm_slam::ExperimentRunner::ConstrainedDescent:
+        case arm_slam::ExperimentRunner::ConstrainedGaussNewton:
+        case arm_slam::ExperimentRunner::ParticleTracking:
+        case arm_slam::ExperimentRunner::GroundTruth:
+        case arm_slam::ExperimentRunner::Odometry:
+            runner.fakeRobot.Draw(true);
             break;
-        case UnconstraintedDescent:
-            freeCamera.Draw();
+        case arm_slam::ExperimentRunner::UnconstraintedDescent:
+            runner.freeCamera.Draw();
             break;
     }
-    odomRobot.Draw(false);
+    runner.odomRobot.Draw(false);
     ofSetLineWidth(1);
     ofSetColor(0, 100, 100);
-    ofVec2f ee = robot.GetEEPos();
+    ofVec2f ee = runner.robot.GetEEPos();
     ofLine(mouseX, mouseY, ee.x, ee.y);
 
+    if (showProfiler)
+    {
+        arm_slam::Profiler::Get().Draw(10, 20);
+    }
 
     /*
     ofSetColor(255, 0, 0);
@@ -283,16 +124,30 @@ void ofApp::draw()
     */
 }
 
+// The dense map only repaints and uploads the tiles fused since last frame.
+void ofApp::UpdateTsdfImage()
+{
+    ARM_SLAM_PROFILE_SCOPE("colorize");
+    if (runner.params.sparseMap)
+    {
+        runner.SetColors(&tsdfImg);
+    }
+    else
+    {
+        tsdfColorizer.Update(runner.GetTrackingMap(), tsdfImg);
+    }
+}
+
 void ofApp::SaveTrajectory()
 {
-    std::ofstream stream;
-    stream.open("./data/traj.txt", std::ios::out);
+    arm_slam::TrajectoryWriter writer;
+    writer.Open("./data/traj.txt", arm_slam::TrajectoryIO::Text, arm_slam::ExperimentRunner::GetTrajectoryColumns(), arm_slam::ExperimentRunner::DOF);
 
     for (size_t i = 0; i < recordedTrajectory.size(); i++)
     {
-        Config& config = recordedTrajectory.at(i);
-        stream << config(0) << " " << config(1) << " " << config(2) << std::endl;
+        writer.Append(recordedTrajectory.at(i).m);
     }
+    writer.Close();
 }
 
 //--------------------------------------------------------------
@@ -300,12 +155,23 @@ void ofApp::keyPressed(int key)
 {
     if(key == 'r')
     {
-        Robot::Config curr = fakeRobot.GetQ();
+        Robot::Config curr = runner.fakeRobot.GetQ();
         Robot::Config randConfig;
         randConfig[0] = ofRandom(-0.1f, 0.1f);
         randConfig[1] = ofRandom(-0.1f, 0.1f);
         randConfig[2] = ofRandom(-0.1f, 0.1f);
-        fakeRobot.SetQ(curr + randConfig);
+        runner.fakeRobot.SetQ(curr + randConfig);
+    }
+
+    if (key == 'p')
+    {
+        showProfiler = !showProfiler;
+    }
+
+    // Chrome trace of the last Profiler::MAX_EVENTS stage timings.
+    if (key == 't')
+    {
+        arm_slam::Profiler::Get().SaveTrace("./data/trace.json");
     }
 
     if (key == 's' && writeTrajectory)
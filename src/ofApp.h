@@ -4,29 +4,14 @@
 #include "Robot.h"
 #include "World.h"
 #include "TSDF.h"
+#include "TSDFColorizer.h"
+#include "ExperimentRunner.h"
 
 class ofApp: public ofBaseApp
 {
     public:
-        typedef arm_slam::Robot<3> Robot;
+        typedef arm_slam::ExperimentRunner::ArmRobot Robot;
         typedef Robot::Config Config;
-        enum Experiment
-        {
-            GroundTruth,
-            Odometry,
-            ConstrainedDescent,
-            UnconstraintedDescent
-        };
-
-        struct ExperimentDatum
-        {
-                Config robotConfig;
-                Config odomConfig;
-                Config trackConfig;
-                float tsdfError;
-                float classificationError;
-                float eePosError;
-        };
 
         void setup();
         void update();
@@ -42,28 +27,17 @@ class ofApp: public ofBaseApp
         void dragEvent(ofDragInfo dragInfo);
         void gotMessage(ofMessage msg);
 
-        void LoadTrajectory();
         void SaveTrajectory();
-        void AppendExperimentDatum();
-        void SaveExperimentData();
-        Config GetJointNoise(const  arm_slam::Robot<3>::Config& curr);
+        void UpdateTsdfImage();
 
-        Robot robot;
-        Robot fakeRobot;
-        Robot odomRobot;
-        arm_slam::DepthCamera freeCamera;
-        Config offset;
-        Config zeroCalibration;
-        arm_slam::World world;
-        arm_slam::TSDF tsdf;
+        arm_slam::ExperimentRunner runner;
         ofImage tsdfImg;
+        arm_slam::TSDFColorizer tsdfColorizer;
         std::vector<float> errs;
-        Experiment experimentMode;
-        float jointNoiseScale;
         bool writeTrajectory;
         bool readTrajectory;
         bool writeExperimentData;
-        size_t iter;
+        // Draw the stage timing overlay; toggled with p.
+        bool showProfiler;
         std::vector<Config> recordedTrajectory;
-        std::vector<ExperimentDatum> experimentData;
 };